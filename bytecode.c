@@ -0,0 +1,569 @@
+/*
+ * Compilation of nstBASIC programs to bytecode and execution of bytecode.
+ *
+ * Copyright 2016, Panagiotis Varelas <varelaspanos@gmail.com>
+ *
+ * nstBASIC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nstBASIC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+/**
+ * @file bytecode.c
+ * @brief Compile programs to bytecode and run the compiled code.
+ *
+ * The compiler follows exactly the same steps as the text interpreter (see execution()
+ * and parse_expr()), so that a compiled program behaves as if it was
+ * interpreted. The engine is enabled by defining @c BYTECODE (see Makefile).
+ */
+
+#include "bytecode.h"
+
+#ifdef BYTECODE
+
+static void emit (uint8_t byte);
+static void emit_word (uint16_t word);
+static void compile_expr (void);
+static uint8_t compile_statement (uint8_t index, uint8_t flags);
+static uint8_t compile_jump (uint8_t op);
+static void skip_statement (void);
+static uint8_t bytecode_size (uint8_t op);
+static uint8_t *find_bytecode (uint8_t *line);
+
+/** The beginning of the bytecode (right after the program). */
+static uint8_t *bc_base;
+/** The end of the bytecode. */
+static uint8_t *bc_end;
+
+/** ***************************************************************************
+ * @brief Compile the program.
+ *
+ * This function compiles the whole program to bytecode. Every line begins
+ * with @c BC_LINE and the last one is an empty line that points to the end of
+ * the program. When all lines are compiled, the target lines of GOTO/GOSUB
+ * are replaced with their offset in the bytecode.
+ *
+ * @note The program should be linked first (see link_program()).
+ * @return Non-zero if the program was compiled successfully.
+ *****************************************************************************/
+uint8_t compile_program (void)
+{
+        uint8_t *line, *previous = NULL;
+        uint8_t *op, *target;
+        uint8_t index, flags, status;
+
+        error_code = 0;
+        // the bytecode takes free memory, where an image might be being saved (see save_slot())
+        rom_wait();
+        bc_base = prog_end_ptr;
+        bc_end = bc_base;
+
+        line = program_space;
+        while (!error_code) {
+                // link previous line with current one
+                if (previous != NULL)
+                        *((uint16_t *)(previous + 3)) = bc_end - bc_base;
+                previous = bc_end;
+                emit (BC_LINE);
+                emit_word (line - program_space);
+                emit_word (0);
+                if (line == prog_end_ptr)
+                        break;
+
+                // compile statements, as execution() would execute them
+                text_ptr = line + sizeof (LINE_NUMBER) + sizeof (LINE_LENGTH);
+                while (!error_code) {
+                        index = scantoken (TOK_CMD, CMD_UNKNOWN);
+                        flags = pgm_read_byte (&command_table[index].flags);
+                        status = compile_statement (index, flags);
+                        if (status == POST_CMD_LOOP)
+                                continue;
+                        if (status == POST_CMD_NEXT_STATEMENT) {
+                                ignorespace();
+                                if ((flags & CMD_FLAG_CHAIN) && *text_ptr == ':') {
+                                        text_ptr++;
+                                        ignorespace();
+                                        continue;
+                                }
+                        }
+                        break;
+                }
+                line += line[sizeof (LINE_NUMBER)];
+        }
+        emit (BC_END);
+
+        // resolve GOTO/GOSUB targets
+        for (op = bc_base; !error_code && op < bc_end; op += bytecode_size (*op)) {
+                if (*op == BC_JUMP || *op == BC_CALL) {
+                        target = find_bytecode (program_space + *((uint16_t *)(op + 1)));
+                        *((uint16_t *)(op + 1)) = target - bc_base;
+                }
+        }
+
+        // any error --> let the text interpreter run (and report) it
+        if (error_code) {
+                error_code = 0;
+                return 0;
+        }
+        return 1;
+}
+
+/** ***************************************************************************
+ * @brief Run the compiled program.
+ *
+ * This function executes the bytecode created by compile_program(), until
+ * the program ends or some error occurs.
+ *
+ * @return The post-execution status. See EXECUTION_STATUS enumerator.
+ *****************************************************************************/
+uint8_t run_program (void)
+{
+        int16_t stack[BC_STACK_SIZE];
+        int16_t *sp = stack;
+        uint8_t *pc = bc_base;
+        uint8_t *line = bc_base;
+        uint8_t *frame;
+        uint8_t index, flags, status;
+        uint8_t (*handler) (void);
+
+        error_code = 0;
+        while (1) {
+                switch (*pc++) {
+                //-----------------------------------------------------------------
+                case BC_LINE:
+                        line = pc - 1;
+                        line_ptr = program_space + *((uint16_t *)pc);
+                        pc += 4;
+                        if (break_test()) {
+                                printmsg (msg_break, stdout);
+                                return POST_CMD_WARM_RESET;
+                        }
+                        break;
+                //-----------------------------------------------------------------
+                case OP_NUM:
+                        *sp++ = *((int16_t *)pc);
+                        pc += 2;
+                        break;
+                case OP_VAR:
+                        *sp++ = ((int16_t *)variables_ptr)[*pc++];
+                        break;
+                case OP_ADD:
+                        sp--;
+                        sp[-1] += sp[0];
+                        break;
+                case OP_SUB:
+                        sp--;
+                        sp[-1] -= sp[0];
+                        break;
+                case OP_MUL:
+                        sp--;
+                        sp[-1] *= sp[0];
+                        break;
+                case OP_DIV:
+                        sp--;
+                        if (sp[0] == 0) {
+                                error_code = 0xB;
+                                return POST_CMD_WARM_RESET;
+                        }
+                        sp[-1] /= sp[0];
+                        break;
+                case OP_NEG:
+                        sp[-1] = -sp[-1];
+                        break;
+                case OP_FN:
+                        sp[-1] = call_function (*pc++, sp[-1]);
+                        if (error_code)
+                                return POST_CMD_WARM_RESET;
+                        break;
+                case OP_RELOP + RELOP_GE:
+                        sp--;
+                        sp[-1] = sp[-1] >= sp[0];
+                        break;
+                case OP_RELOP + RELOP_NE:
+                case OP_RELOP + RELOP_NE_BANG:
+                        sp--;
+                        sp[-1] = sp[-1] != sp[0];
+                        break;
+                case OP_RELOP + RELOP_GT:
+                        sp--;
+                        sp[-1] = sp[-1] > sp[0];
+                        break;
+                case OP_RELOP + RELOP_EQ:
+                        sp--;
+                        sp[-1] = sp[-1] == sp[0];
+                        break;
+                case OP_RELOP + RELOP_LE:
+                        sp--;
+                        sp[-1] = sp[-1] <= sp[0];
+                        break;
+                case OP_RELOP + RELOP_LT:
+                        sp--;
+                        sp[-1] = sp[-1] < sp[0];
+                        break;
+                //-----------------------------------------------------------------
+                case BC_LET:
+                        ((int16_t *)variables_ptr)[*pc++] = *--sp;
+                        break;
+                case BC_IF:
+                        // false --> proceed to next line
+                        if (*--sp == 0)
+                                pc = bc_base + *((uint16_t *)(line + 3));
+                        break;
+                case BC_JUMP:
+                        pc = bc_base + *((uint16_t *)pc);
+                        break;
+                case BC_GOTO:
+                        line_number = *--sp;
+                        pc = find_bytecode (find_line());
+                        break;
+                case BC_CALL:
+                case BC_GOSUB:
+                        frame = push_frame (sizeof (struct stack_gosub_frame));
+                        if (frame == NULL)
+                                return POST_CMD_WARM_RESET;
+                        ((struct stack_gosub_frame *)frame)->frame_type = STACK_GOSUB_FLAG;
+                        ((struct stack_gosub_frame *)frame)->line_ptr = line;
+                        if (pc[-1] == BC_CALL) {
+                                ((struct stack_gosub_frame *)frame)->text_ptr = pc + 2;
+                                pc = bc_base + *((uint16_t *)pc);
+                        } else {
+                                ((struct stack_gosub_frame *)frame)->text_ptr = pc;
+                                line_number = *--sp;
+                                pc = find_bytecode (find_line());
+                        }
+                        break;
+                case BC_RETURN:
+                        frame = unwind_stack (CMD_RETURN, 0);
+                        if (error_code)
+                                return POST_CMD_WARM_RESET;
+                        line = ((struct stack_gosub_frame *)frame)->line_ptr;
+                        line_ptr = program_space + *((uint16_t *)(line + 1));
+                        pc = ((struct stack_gosub_frame *)frame)->text_ptr;
+                        break;
+                case BC_FOR:
+                        frame = (uint8_t *)push_for_frame (*pc + 'A');
+                        if (frame == NULL)
+                                return POST_CMD_WARM_RESET;
+                        sp -= 3;
+                        ((int16_t *)variables_ptr)[*pc++] = sp[0];
+                        ((struct stack_for_frame *)frame)->terminal = sp[1];
+                        ((struct stack_for_frame *)frame)->step = sp[2];
+                        ((struct stack_for_frame *)frame)->line_ptr = line;
+                        ((struct stack_for_frame *)frame)->text_ptr = pc;
+                        break;
+                case BC_NEXT:
+                        frame = unwind_stack (CMD_NEXT, *pc++ + 'A');
+                        if (error_code)
+                                return POST_CMD_WARM_RESET;
+                        // loop again --> jump back to the beginning of the loop
+                        if (frame != NULL) {
+                                line = ((struct stack_for_frame *)frame)->line_ptr;
+                                line_ptr = program_space + *((uint16_t *)(line + 1));
+                                pc = ((struct stack_for_frame *)frame)->text_ptr;
+                                if (break_test()) {
+                                        printmsg (msg_break, stdout);
+                                        return POST_CMD_WARM_RESET;
+                                }
+                        }
+                        break;
+                //-----------------------------------------------------------------
+                case BC_TEXT:
+                        // execute statement by its handler
+                        text_ptr = program_space + *((uint16_t *)pc);
+                        pc += 2;
+                        index = scantoken (TOK_CMD, CMD_UNKNOWN);
+                        handler = pgm_read_ptr (&command_table[index].handler);
+                        flags = pgm_read_byte (&command_table[index].flags);
+                        status = handler();
+                        if (status == POST_CMD_WARM_RESET)
+                                return POST_CMD_WARM_RESET;
+                        if (status == POST_CMD_NEXT_STATEMENT) {
+                                ignorespace();
+                                if ((flags & CMD_FLAG_CHAIN) && *text_ptr == ':')
+                                        break;
+                        }
+                        // proceed to next line
+                        pc = bc_base + *((uint16_t *)(line + 3));
+                        break;
+                //-----------------------------------------------------------------
+                case BC_END:
+                default:
+                        return POST_CMD_WARM_RESET;
+                }
+        }
+}
+
+/** ***************************************************************************
+ * @brief Append a single byte to the bytecode.
+ *
+ * @param byte The value to append.
+ *****************************************************************************/
+static void emit (uint8_t byte)
+{
+        if (bc_end >= (uint8_t *)line_index) {
+                error_code = 0x16;
+                return;
+        }
+        *bc_end = byte;
+        bc_end++;
+}
+
+/** ***************************************************************************
+ * @brief Append a 16bit value to the bytecode.
+ *
+ * @param word The value to append.
+ *****************************************************************************/
+static void emit_word (uint16_t word)
+{
+        emit (word & 0xFF);
+        emit (word >> 8);
+}
+
+/** ***************************************************************************
+ * @brief Compile an expression.
+ *
+ * The expression that begins at @c text_ptr is compiled by parse_expr() and
+ * appended to the bytecode.
+ *****************************************************************************/
+static void compile_expr (void)
+{
+        expr_code = bc_end;
+        parse_expr();
+        bc_end = expr_code;
+        expr_code = NULL;
+}
+
+/** ***************************************************************************
+ * @brief Compile a single statement.
+ *
+ * This function checks the syntax of the statement that begins at
+ * @c text_ptr, just like the respective handler would do, and emits the
+ * bytecode that executes it.
+ *
+ * @param index The command of the statement (see scantoken()).
+ * @param flags The flags of the command (see @c command_table).
+ * @return The post-execution status that the handler would return.
+ *****************************************************************************/
+static uint8_t compile_statement (uint8_t index, uint8_t flags)
+{
+        uint8_t var;
+
+        switch (index) {
+        //-----------------------------------------------------------------
+        case CMD_LET:
+        case CMD_UNKNOWN:
+                if (*text_ptr < 'A' || *text_ptr > 'Z' || (text_ptr[1] >= 'A' && text_ptr[1] <= 'Z'))
+                        break;
+                var = *text_ptr - 'A';
+                text_ptr++;
+                ignorespace();
+                if (*text_ptr != TOK_EQ)
+                        break;
+                text_ptr++;
+                ignorespace();
+                compile_expr();
+                if (*text_ptr != LF && *text_ptr != ':')
+                        break;
+                emit (BC_LET);
+                emit (var);
+                return POST_CMD_NEXT_STATEMENT;
+        //-----------------------------------------------------------------
+        case CMD_IF:
+                compile_expr();
+                if (*text_ptr == LF)
+                        break;
+                emit (BC_IF);
+                return POST_CMD_LOOP;
+        //-----------------------------------------------------------------
+        case CMD_GOTO:
+                return compile_jump (BC_JUMP);
+        case CMD_GOSUB:
+                return compile_jump (BC_CALL);
+        case CMD_RETURN:
+                emit (BC_RETURN);
+                return POST_CMD_EXEC_LINE;
+        //-----------------------------------------------------------------
+        case CMD_FOR:
+                ignorespace();
+                if (*text_ptr < 'A' || *text_ptr > 'Z')
+                        break;
+                var = *text_ptr - 'A';
+                text_ptr++;
+                ignorespace();
+                if (*text_ptr != TOK_EQ)
+                        break;
+                text_ptr++;
+                ignorespace();
+                compile_expr();
+                if (scantoken (TOK_TO, 1) != 0)
+                        break;
+                compile_expr();
+                if (scantoken (TOK_STEP, 1) == 0)
+                        compile_expr();
+                else {
+                        emit (OP_NUM);
+                        emit_word (1);
+                }
+                ignorespace();
+                if (*text_ptr != LF && *text_ptr != ':')
+                        break;
+                emit (BC_FOR);
+                emit (var);
+                return POST_CMD_NEXT_STATEMENT;
+        case CMD_NEXT:
+                ignorespace();
+                if (*text_ptr < 'A' || *text_ptr > 'Z')
+                        break;
+                var = *text_ptr - 'A';
+                text_ptr++;
+                ignorespace();
+                if (*text_ptr != ':' && *text_ptr != LF)
+                        break;
+                emit (BC_NEXT);
+                emit (var);
+                return POST_CMD_NEXT_STATEMENT;
+        //-----------------------------------------------------------------
+        case CMD_END:
+        case CMD_STOP:
+                if (*text_ptr != LF)
+                        break;
+                emit (BC_END);
+                return POST_CMD_EXEC_LINE;
+        case CMD_REM:
+        case CMD_HASH:
+        case CMD_QUOTE:
+                return POST_CMD_NEXT_LINE;
+        //-----------------------------------------------------------------
+        default:
+                if (!(flags & CMD_FLAG_SIMPLE))
+                        break;
+                // find the beginning of the statement (the token of the command)
+                do
+                        text_ptr--;
+                while (*text_ptr != TOK_CMD + index);
+                emit (BC_TEXT);
+                emit_word (text_ptr - program_space);
+                skip_statement();
+                return POST_CMD_NEXT_STATEMENT;
+        }
+        // unsupported statement or syntax error
+        if (!error_code)
+                error_code = 0x2;
+        return POST_CMD_WARM_RESET;
+}
+
+/** ***************************************************************************
+ * @brief Compile GOTO or GOSUB.
+ *
+ * If the target is a constant, it is stored as the offset of the target line
+ * and it will be replaced with the offset of the line in the bytecode, when
+ * all lines are compiled. Otherwise, the target is calculated at run time.
+ *
+ * @param op Either @c BC_JUMP or @c BC_CALL.
+ * @return The post-execution status that the handler would return.
+ *****************************************************************************/
+static uint8_t compile_jump (uint8_t op)
+{
+        uint8_t *expr = bc_end;
+
+        ignorespace();
+        // target resolved by link_program()
+        if (*text_ptr == TOK_LINK) {
+                emit (op);
+                emit_word (*((uint16_t *)(text_ptr + 1)));
+                return POST_CMD_EXEC_LINE;
+        }
+        compile_expr();
+        if (error_code || *text_ptr != LF) {
+                error_code = 0x4;
+                return POST_CMD_WARM_RESET;
+        }
+        // constant target (but no such line)
+        if (bc_end - expr == 3 && *expr == OP_NUM) {
+                bc_end = expr;
+                line_number = *((uint16_t *)(expr + 1));
+                emit (op);
+                emit_word (find_line() - program_space);
+                return POST_CMD_EXEC_LINE;
+        }
+        // computed target
+        emit (op + 1);
+        return POST_CMD_EXEC_LINE;
+}
+
+/** ***************************************************************************
+ * @brief Skip current statement.
+ *
+ * This function moves @c text_ptr to the end of the current statement
+ * (the next colon or LF that is not part of a string).
+ *****************************************************************************/
+static void skip_statement (void)
+{
+        uint8_t quote = 0;
+
+        while (*text_ptr != LF) {
+                if (quote) {
+                        if (*text_ptr == quote)
+                                quote = 0;
+                } else if (*text_ptr == '"' || *text_ptr == '\'')
+                        quote = *text_ptr;
+                else if (*text_ptr == ':')
+                        return;
+                else if (*text_ptr == TOK_NUM || *text_ptr == TOK_LINK)
+                        text_ptr += 2;
+                text_ptr++;
+        }
+}
+
+/** ***************************************************************************
+ * @brief Get the size of an instruction.
+ *
+ * @param op The opcode of the instruction.
+ * @return The size of the opcode and its operands.
+ *****************************************************************************/
+static uint8_t bytecode_size (uint8_t op)
+{
+        switch (op) {
+        case BC_LINE:
+                return 5;
+        case OP_NUM:
+        case BC_JUMP:
+        case BC_CALL:
+        case BC_TEXT:
+                return 3;
+        case OP_VAR:
+        case OP_FN:
+        case BC_LET:
+        case BC_FOR:
+        case BC_NEXT:
+                return 2;
+        }
+        return 1;
+}
+
+/** ***************************************************************************
+ * @brief Find the bytecode of a program line.
+ *
+ * @param line The program line (or the end of the program).
+ * @return Pointer to the @c BC_LINE instruction of the specified line.
+ *****************************************************************************/
+static uint8_t *find_bytecode (uint8_t *line)
+{
+        uint8_t *op = bc_base;
+        uint16_t offset = line - program_space;
+
+        while (*((uint16_t *)(op + 1)) != offset)
+                op = bc_base + *((uint16_t *)(op + 3));
+        return op;
+}
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ * Compilation of nstBASIC programs to bytecode and execution of bytecode.
+ *
+ * Copyright 2016, Panagiotis Varelas <varelaspanos@gmail.com>
+ *
+ * nstBASIC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nstBASIC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+/**
+ * @file bytecode.h
+ * @brief Opcodes of the bytecode engine and some prototypes.
+ *
+ * When a program runs, it is first compiled to a compact, stack-based bytecode,
+ * which is placed in free memory (right after the program). Expressions are
+ * stored in reverse polish notation (see @c EXPR_OPS in parser.h), variables are referenced by their slot
+ * and jumps by the offset of the target line in the bytecode. Every line begins
+ * with @c BC_LINE, followed by the offset of the program line and the offset
+ * of the next line in the bytecode.
+ *
+ * Statements that do not affect the flow of execution (see @c CMD_FLAG_SIMPLE)
+ * are not compiled, but executed by their handler (@c BC_TEXT). If a program
+ * cannot be compiled (because of some unsupported statement, a syntax error or
+ * lack of memory) it runs by the text interpreter, as usual.
+ */
+
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+// ------------------------------------------------------------------------------
+// INCLUDES
+// ------------------------------------------------------------------------------
+
+#include "interpreter.h"
+#include "parser.h"
+
+// ------------------------------------------------------------------------------
+// PROTOTYPES
+// ------------------------------------------------------------------------------
+
+uint8_t compile_program (void);
+uint8_t run_program (void);
+
+// ------------------------------------------------------------------------------
+// MACROS
+// ------------------------------------------------------------------------------
+
+/** The depth of the evaluation stack (FOR keeps two values, while evaluating the third). */
+#define BC_STACK_SIZE (EXPR_STACK_SIZE + 2)
+
+// ------------------------------------------------------------------------------
+// ENUMERATORS
+// ------------------------------------------------------------------------------
+
+enum BYTECODES {
+        BC_LINE = OP_RELOP + RELOP_UNKNOWN,     // program line offset, next line offset
+        BC_LET,                 // variable slot
+        BC_IF,
+        BC_JUMP,                // target offset
+        BC_GOTO,
+        BC_CALL,                // target offset
+        BC_GOSUB,
+        BC_RETURN,
+        BC_FOR,                 // variable slot
+        BC_NEXT,                // variable slot
+        BC_TEXT,                // statement offset
+        BC_END
+};
+
+#endif
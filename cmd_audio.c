@@ -31,11 +31,17 @@ uint8_t stop (void)
         return POST_CMD_NEXT_STATEMENT;
 }
 
+uint8_t beep (void)
+{
+        do_beep();
+        return POST_CMD_NEXT_STATEMENT;
+}
+
 uint8_t tempo (void)
 {
                 uint16_t specified_tempo;
                 ignorespace();
-                specified_tempo = parse_expr_s1();
+                specified_tempo = parse_expr();
                 if (error_code) {
             return POST_CMD_WARM_RESET;
         }
@@ -27,5 +27,6 @@ uint8_t play (void);
 uint8_t stop (void);
 uint8_t tempo (void);
 uint8_t music (void);
+uint8_t beep (void);
 
 #endif
@@ -19,11 +19,97 @@
 
 #include "cmd_eeprom.h"
 
+static uint8_t get_name (uint8_t optional);
+static uint8_t open_directory (uint8_t create);
+static void new_directory (uint16_t used);
+static uint8_t find_slot (struct eeprom_slot *slot);
+static void read_slot (uint8_t index, struct eeprom_slot *slot);
+static void write_slot (uint8_t index, struct eeprom_slot *slot);
+static void free_slot (uint8_t index);
+static uint16_t find_space (uint16_t length, uint8_t skip);
+static uint8_t load_slot (void);
+static uint8_t save_slot (uint8_t format);
+static uint16_t image_checksum (uint16_t crc, uint8_t *data, uint16_t length);
+static uint16_t stored_checksum (uint16_t offset, uint16_t length);
+static void image_pack (FILE *stream);
+static void pack_literals (uint8_t *data, uint8_t *end, FILE *stream);
+static uint16_t *pack_bucket (uint8_t *data);
+static void pack_insert (uint8_t *data);
+static uint8_t image_unpack (struct eeprom_slot *slot, uint8_t *data);
+static uint8_t image_read (struct eeprom_slot *slot, uint8_t *data);
+static void snapshot_write (FILE *stream);
+static void image_list (struct eeprom_slot *slot);
+static void print_sizes (struct eeprom_slot *slot);
+static uint8_t overlay_of (struct eeprom_slot *slot);
+static int count_char (char chr, FILE *stream);
+
+/** The name of the program (padded with zeros, all zeros for ESAVE/ELOAD). */
+static uint8_t name[FILENAME_SIZE];
+
+/** The length and the checksum of a listing, calculated before saving it. */
+static uint16_t count_length, count_checksum;
+/** Where the packed image is kept, while measuring it, and how many bytes fit there (see save_slot()). */
+static uint8_t *pack_buffer;
+static uint16_t pack_room;
+/** The table of image_pack(), at the end of free memory, and its buckets (0 if there is no room). */
+static uint16_t *pack_table;
+static uint8_t pack_buckets;
+static FILE stream_count = FDEV_SETUP_STREAM (count_char, NULL, _FDEV_SETUP_WRITE);
+
+/** The header of the directory (see open_directory()). */
+static struct eeprom_header header;
+
+/** Where overlays are loaded (right after the program), NULL if there are none. */
+static uint8_t *overlay_ptr;
+/** The slot of the overlay that is loaded (@c EEPROM_SLOTS if none). */
+static uint8_t overlay_slot;
+/** The last line of the program, before the overlay. */
+static LINE_NUMBER overlay_line;
+
+/** The state of the interpreter, while saving or resuming a snapshot. */
+static struct snapshot_state state;
+/** The name of the snapshot (see find_slot()). */
+static const uint8_t snapshot_name[FILENAME_SIZE] = SNAPSHOT_NAME;
+
 uint8_t elist (void)
 {
     uint8_t value;
-        eeprom_ptr = 0;
-        for (uint16_t i = 0 ; i < (E2END + 1); i++) {
+        uint16_t i, end;
+        struct eeprom_slot slot;
+
+        if (get_name (1))
+                return POST_CMD_WARM_RESET;
+
+        rom_wait();
+        if (open_directory (0)) {
+                if (find_slot (&slot) == EEPROM_SLOTS || slot.format == SLOT_FREE) {
+                        error_code = 0x1B;
+                        return POST_CMD_WARM_RESET;
+                }
+                // program image (or snapshot) --> list it like LIST does
+                if (slot.format != SLOT_LISTING) {
+                        image_list (&slot);
+                        if (error_code)
+                                return POST_CMD_WARM_RESET;
+                        print_sizes (&slot);
+                        return POST_CMD_NEXT_LINE;
+                }
+                i = slot.offset;
+                end = slot.offset + slot.length;
+        } else {
+                // no directory --> there might be a listing at the beginning
+                if (name[0] != 0) {
+                        error_code = 0x1B;
+                        return POST_CMD_WARM_RESET;
+                }
+                i = 0;
+                end = E2END + 1;
+        }
+
+        // listing --> print it as it is
+        eeprom_ptr = i;
+        eeprom_end = end;
+        for ( ; i < end; i++) {
                 value = fgetc (&stream_eeprom);
                 if (value == '\0')
             return POST_CMD_NEXT_LINE;
@@ -38,43 +124,1071 @@ uint8_t elist (void)
 
 uint8_t eformat (void)
 {
+        uint16_t end = E2END + 1;
+
+        // only the bytes written since the last EFORMAT need erasing
+        // (the stream skips those that are erased already)
+        rom_wait();
+        if (open_directory (0))
+                end = header.used;
         eeprom_ptr = 0;
-        for (uint16_t i = 0 ; i < E2END ; i++) {
-                fputc ('\0', &stream_eeprom);
+        for (uint16_t i = 0 ; i < end ; i++) {
+                fputc (EEPROM_ERASED, &stream_eeprom);
                 // print a dot every 64 bytes
                 if ((i & 0x07f) == 0x40)
             fputc ('.', stdout);
         }
         newline (stdout);
+        rom_wait();
+        new_directory (EEPROM_DATA);
         return POST_CMD_NEXT_LINE;
 }
 
 uint8_t eload (void)
 {
-    uint8_t value;
-        // read the first byte of eeprom
-        // if it is a number, assume there is a program we can load
-        eeprom_ptr = 0;
-        value = fgetc (&stream_eeprom);
-        if (value >= '0' && value <= '9') {
-                eeprom_ptr = 0;
-                prog_end_ptr = program_space;
-                sys_config |= cfg_from_eeprom;
-        } else
-                error_code = 0x9;
-    return POST_CMD_WARM_RESET;
+        if (get_name (1))
+                return POST_CMD_WARM_RESET;
+        return load_slot();
+}
+
+uint8_t echain (void)
+{
+        // run program after loading it
+        sys_config |= cfg_run_after_load;
+        return eload();
 }
 
 uint8_t esave (void)
 {
-        eeprom_ptr = 0;
-        uint8_t *line = find_line();
-        LINE_LENGTH length = 0;
-        while (line != prog_end_ptr) {
-                printline (line, &stream_eeprom);
-                length = (LINE_LENGTH) (*(line + sizeof (LINE_NUMBER)));
-                line += length;
-        }
-        fputc (0, &stream_eeprom);
+        uint8_t format = SLOT_IMAGE;
+
+        // ESAVE LIST --> save the listing of the program (for interchange)
+        ignorespace();
+        if (*text_ptr == TOK_CMD + CMD_LIST) {
+                format = SLOT_LISTING;
+                text_ptr++;
+        }
+        if (get_name (1))
+                return POST_CMD_WARM_RESET;
+        return save_slot (format);
+}
+
+uint8_t files (void)
+{
+        uint8_t index, i;
+        struct eeprom_slot slot;
+
+        rom_wait();
+        if (open_directory (0)) {
+                for (index = 0; index < EEPROM_SLOTS; index++) {
+                        read_slot (index, &slot);
+                        if (slot.format == SLOT_FREE)
+                                continue;
+                        // name (in quotes), size and format
+                        fputc (DQUOTE, stdout);
+                        for (i = 0; i < FILENAME_SIZE && slot.name[i] != 0; i++)
+                                fputc (slot.name[i], stdout);
+                        fputc (DQUOTE, stdout);
+                        fputc (' ', stdout);
+                        print_sizes (&slot);
+                }
+        }
+        printnum (files_free(), stdout);
+        printmsg (msg_available, stdout);
+        return POST_CMD_NEXT_LINE;
+}
+
+uint8_t cformat (void)
+{
+        uint8_t index;
+        struct eeprom_slot slot;
+
+        // CFORMAT "name" --> remove one program
+        ignorespace();
+        if (*text_ptr != LF) {
+                if (get_name (0))
+                        return POST_CMD_WARM_RESET;
+                rom_wait();
+                if (!open_directory (0) || (index = find_slot (&slot)) == EEPROM_SLOTS || slot.format == SLOT_FREE) {
+                        error_code = 0x1B;
+                        return POST_CMD_WARM_RESET;
+                }
+                free_slot (index);
+                return POST_CMD_NEXT_LINE;
+        }
+
+        // CFORMAT --> create an empty directory (nothing is erased)
+        rom_wait();
+        new_directory (open_directory (0) ? header.used : E2END + 1);
+        return POST_CMD_NEXT_LINE;
+}
+
+uint8_t cload (void)
+{
+        if (get_name (0))
+                return POST_CMD_WARM_RESET;
+        return load_slot();
+}
+
+uint8_t cchain (void)
+{
+        // run program after loading it
+        sys_config |= cfg_run_after_load;
+        return cload();
+}
+
+uint8_t csave (void)
+{
+        uint8_t format = SLOT_IMAGE;
+
+        // CSAVE LIST "name" --> save the listing of the program
+        ignorespace();
+        if (*text_ptr == TOK_CMD + CMD_LIST) {
+                format = SLOT_LISTING;
+                text_ptr++;
+        }
+        if (get_name (0))
+                return POST_CMD_WARM_RESET;
+        return save_slot (format);
+}
+
+uint8_t esync (void)
+{
+        uint16_t value;
+        // non-zero: EEPROM writes wait, 0: they go on in the background
+        value = parse_expr();
+        if (error_code)
+                return POST_CMD_WARM_RESET;
+        rom_async (value == 0);
+        return POST_CMD_NEXT_STATEMENT;
+}
+
+/** ***************************************************************************
+ * @brief Get the number of EEPROM bytes that are not occupied by programs.
+ *****************************************************************************/
+uint16_t files_free (void)
+{
+        uint8_t index;
+        uint16_t free = E2END + 1 - EEPROM_DATA;
+        struct eeprom_slot slot;
+
+        rom_wait();
+        if (!open_directory (0))
+                return free;
+        for (index = 0; index < EEPROM_SLOTS; index++) {
+                read_slot (index, &slot);
+                if (slot.format != SLOT_FREE)
+                        free -= slot.length;
+        }
+        return free;
+}
+
+/** ***************************************************************************
+ * @brief Get the size of the programs stored in EEPROM.
+ *
+ * @param packed Where to store the bytes they occupy in EEPROM.
+ * @return The bytes they occupy in memory.
+ *****************************************************************************/
+uint16_t files_stored (uint16_t *packed)
+{
+        uint8_t index;
+        uint16_t size = 0;
+        struct eeprom_slot slot;
+
+        *packed = 0;
+        rom_wait();
+        if (!open_directory (0))
+                return 0;
+        for (index = 0; index < EEPROM_SLOTS; index++) {
+                read_slot (index, &slot);
+                if (slot.format != SLOT_FREE) {
+                        size += slot.size;
+                        *packed += slot.length;
+                }
+        }
+        return size;
+}
+
+/** ***************************************************************************
+ * @brief Prepare to load overlays, when the program starts.
+ *
+ * The overlays of a program are program images named after it: "GAME.1",
+ * "GAME.MAP" and so on belong to "GAME" (see program_name). Their lines all
+ * follow the lines of the program. When GOTO/GOSUB jumps to a line that is
+ * not in the program, the overlay that holds it is loaded right after the
+ * program (see overlay_load()). Variables and the stack stay as they are.
+ *
+ * @return Non-zero if the program has overlays.
+ *****************************************************************************/
+uint8_t overlay_begin (void)
+{
+        uint8_t index;
+        uint8_t *line;
+        struct eeprom_slot slot;
+
+        overlay_ptr = NULL;
+        overlay_slot = EEPROM_SLOTS;
+        overlay_line = 0;
+        for (line = program_space; line != prog_end_ptr; line += line[sizeof (LINE_NUMBER)])
+                overlay_line = *((LINE_NUMBER *)line);
+
+        // a program without a name has no overlays
+        if (program_name[0] == 0)
+                return 0;
+        rom_wait();
+        if (!open_directory (0))
+                return 0;
+        for (index = 0; index < EEPROM_SLOTS; index++) {
+                read_slot (index, &slot);
+                if (overlay_of (&slot)) {
+                        overlay_ptr = prog_end_ptr;
+                        return 1;
+                }
+        }
+        return 0;
+}
+
+/** ***************************************************************************
+ * @brief Load the overlay that holds line @c line_number.
+ *
+ * The overlay replaces the one that is loaded. Stack frames that return to
+ * the replaced lines are kept by line number (see park_frames()).
+ *
+ * @return Non-zero if an overlay was loaded (on error, @c error_code is set).
+ *****************************************************************************/
+uint8_t overlay_load (void)
+{
+        uint8_t index;
+        LINE_NUMBER target = line_number;
+        struct eeprom_slot slot;
+
+        if (overlay_ptr == NULL)
+                return 0;
+        rom_wait();
+        if (!open_directory (0))
+                return 0;
+        for (index = 0; index < EEPROM_SLOTS; index++) {
+                read_slot (index, &slot);
+                if (overlay_of (&slot) && slot.first <= target && target <= slot.last)
+                        break;
+        }
+        if (index == EEPROM_SLOTS || index == overlay_slot)
+                return 0;
+
+        // drop the overlay that is loaded
+        park_frames (overlay_ptr);
+        unlink_program();
+        drop_index();
+        prog_end_ptr = overlay_ptr;
+        overlay_slot = EEPROM_SLOTS;
+
+        if (slot.size > tail_ptr - overlay_ptr) {
+                error_code = 0x16;
+                return 0;
+        }
+        if (image_read (&slot, overlay_ptr)) {
+                error_code = 0x19;
+                return 0;
+        }
+        prog_end_ptr = overlay_ptr + slot.size;
+        overlay_slot = index;
+        link_program();
+        line_number = target;
+        return 1;
+}
+
+/** ***************************************************************************
+ * @brief Check whether a slot holds an overlay of the program (see overlay_begin()).
+ *****************************************************************************/
+static uint8_t overlay_of (struct eeprom_slot *slot)
+{
+        uint8_t i;
+
+        if (slot->format != SLOT_IMAGE || slot->first <= overlay_line)
+                return 0;
+        // the name of the program, then a dot
+        for (i = 0; i < FILENAME_SIZE && program_name[i] != 0; i++)
+                if (slot->name[i] != program_name[i])
+                        return 0;
+        return i > 0 && i < FILENAME_SIZE && slot->name[i] == '.';
+}
+
+/** ***************************************************************************
+ * @brief Drop the overlay (if any), when the program ends.
+ *****************************************************************************/
+void overlay_end (void)
+{
+        if (overlay_ptr == NULL)
+                return;
+        unlink_program();
+        drop_index();
+        prog_end_ptr = overlay_ptr;
+        overlay_ptr = NULL;
+}
+
+/** ***************************************************************************
+ * @brief Save the state of the interpreter (SNAPSHOT).
+ *
+ * The program, the variables and the stack are saved to EEPROM, along with
+ * the statement that follows SNAPSHOT. When powered up, nstBASIC resumes from
+ * there (see main()). In direct mode, the program will run from the beginning.
+ * The snapshot is named "SNAPSHOT" (CFORMAT "SNAPSHOT" removes it). It is
+ * written in the background, while the program goes on, unless it does not
+ * fit in free memory (see save_slot()).
+ *
+ * @return The post-execution status.
+ *****************************************************************************/
+uint8_t snapshot (void)
+{
+        uint8_t *line = line_ptr;
+        uint8_t *text;
+        uint8_t i, status;
+        LINE_NUMBER number = line_number;
+
+        ignorespace();
+        if (*text_ptr != ':' && *text_ptr != LF) {
+                error_code = 0x2;
+                return POST_CMD_WARM_RESET;
+        }
+
+        // resume with the statement that follows
+        state.line = SNAPSHOT_NONE;
+        state.text = SNAPSHOT_NONE;
+        if (line != NULL) {
+                text = text_ptr;
+                if (*text == ':') {
+                        text++;
+                        while (*text == ' ')
+                                text++;
+                } else {
+                        line += line[sizeof (LINE_NUMBER)];
+                        text = line + sizeof (LINE_NUMBER) + sizeof (LINE_LENGTH);
+                }
+                state.line = line - program_space;
+                state.text = text - program_space;
+        }
+        state.overlay = (overlay_ptr == NULL) ? SNAPSHOT_NONE : overlay_ptr - program_space;
+        state.overlay_slot = overlay_slot;
+        state.overlay_line = overlay_line;
+        for (i = 0; i < FILENAME_SIZE; i++)
+                state.name[i] = program_name[i];
+        state.length = sizeof (struct snapshot_state) + (program_space + MEMORY_SIZE - stack_ptr);
+        for (i = 0; i < 26; i++)
+                state.for_frames[i] = for_frames[i];
+        for (i = 0; i < 27; i++)
+                state.variables[i] = ((int16_t *)variables_ptr)[i];
+
+        for (i = 0; i < FILENAME_SIZE; i++)
+                name[i] = snapshot_name[i];
+        relocate_frames (1);
+        status = save_slot (SLOT_SNAPSHOT);
+        relocate_frames (0);
+
+        // the program goes on (link it again)
+        text = text_ptr;
+        link_program();
+        text_ptr = text;
+        line_number = number;
+        if (status == POST_CMD_WARM_RESET)
+                return status;
+        return POST_CMD_NEXT_STATEMENT;
+}
+
+/** ***************************************************************************
+ * @brief Check for a snapshot in EEPROM (see snapshot()).
+ *****************************************************************************/
+uint8_t find_snapshot (void)
+{
+        uint8_t i;
+        struct eeprom_slot slot;
+
+        for (i = 0; i < FILENAME_SIZE; i++)
+                name[i] = snapshot_name[i];
+        rom_wait();
+        return open_directory (0) && find_slot (&slot) != EEPROM_SLOTS && slot.format == SLOT_SNAPSHOT;
+}
+
+/** ***************************************************************************
+ * @brief Resume the snapshot.
+ *
+ * The program, the variables and the stack are restored as they were saved
+ * by snapshot(), so that the interpreter goes on with the statement that
+ * followed SNAPSHOT.
+ *
+ * @return Non-zero if there is some statement to execute (on error,
+ * @c error_code is set).
+ *****************************************************************************/
+uint8_t resume (void)
+{
+        uint8_t i;
+        uint16_t stack;
+        struct eeprom_slot slot;
+
+        for (i = 0; i < FILENAME_SIZE; i++)
+                name[i] = snapshot_name[i];
+        rom_wait();
+        if (!open_directory (0) || find_slot (&slot) == EEPROM_SLOTS || slot.format != SLOT_SNAPSHOT) {
+                error_code = 0x1B;
+                return 0;
+        }
+        eeprom_read_block (&state, (void *)slot.offset, sizeof (struct snapshot_state));
+        stack = state.length - sizeof (struct snapshot_state);
+
+        clear_program();
+        drop_index();
+        if (slot.size > variables_ptr - program_space) {
+                error_code = 0x16;
+                return 0;
+        }
+        tail_ptr = variables_ptr - slot.size;
+        if (state.length < sizeof (struct snapshot_state) || stack > STACK_SIZE || image_read (&slot, tail_ptr)) {
+                clear_program();
+                error_code = 0x19;
+                return 0;
+        }
+
+        // variables and stack, as they were
+        for (i = 0; i < FILENAME_SIZE; i++)
+                program_name[i] = state.name[i];
+        for (i = 0; i < 27; i++)
+                ((int16_t *)variables_ptr)[i] = state.variables[i];
+        for (i = 0; i < 26; i++)
+                for_frames[i] = state.for_frames[i];
+        stack_ptr = program_space + MEMORY_SIZE - stack;
+        eeprom_read_block (stack_ptr, (void *)(slot.offset + sizeof (struct snapshot_state)), stack);
+        relocate_frames (0);
+
+        // the program is moved to the beginning of program memory
+        link_program();
+        if (state.line == SNAPSHOT_NONE) {
+                overlay_begin();
+                line_ptr = program_space;
+                text_ptr = line_ptr + sizeof (LINE_NUMBER) + sizeof (LINE_LENGTH);
+        } else {
+                overlay_ptr = (state.overlay == SNAPSHOT_NONE) ? NULL : program_space + state.overlay;
+                overlay_slot = state.overlay_slot;
+                overlay_line = state.overlay_line;
+                line_ptr = program_space + state.line;
+                text_ptr = program_space + state.text;
+        }
+        if (line_ptr == prog_end_ptr)
+                return 0;
+
+        // as RUN does
+        EIMSK |= BREAK_INT;
+        putchar (vid_cursor_off);
+        putchar (vid_scroll_off);
+        return 1;
+}
+
+/** ***************************************************************************
+ * @brief Get the name of a program.
+ *
+ * The name is expected in quotes (see valid_filename()) and it is stored in
+ * @c name. If it is optional and missing, @c name is cleared.
+ *
+ * @param optional Whether the name may be omitted (ESAVE, ELOAD, etc).
+ * @return Non-zero if some error occured.
+ *****************************************************************************/
+static uint8_t get_name (uint8_t optional)
+{
+        uint8_t i;
+        uint8_t *filename;
+
+        ignorespace();
+        if (optional && *text_ptr == LF) {
+                for (i = 0; i < FILENAME_SIZE; i++)
+                        name[i] = 0;
+                return 0;
+        }
+        filename = valid_filename();
+        if (filename == NULL)
+                return 1;
+        for (i = 0; i < FILENAME_SIZE; i++)
+                name[i] = filename[i];
+        ignorespace();
+        if (*text_ptr != LF) {
+                error_code = 0x4;
+                return 1;
+        }
+        return 0;
+}
+
+/** ***************************************************************************
+ * @brief Check for the directory of programs in EEPROM.
+ *
+ * Its header is read into @c header.
+ *
+ * @param create Create an empty directory, if there is none.
+ * @return Non-zero if the directory exists (or has just been created).
+ *****************************************************************************/
+static uint8_t open_directory (uint8_t create)
+{
+        eeprom_read_block (&header, 0, sizeof (struct eeprom_header));
+        if (header.magic == EEPROM_MAGIC && header.version == EEPROM_VERSION)
+                return 1;
+        if (!create)
+                return 0;
+        // whatever was there before has not been erased
+        new_directory (E2END + 1);
+        return 1;
+}
+
+/** ***************************************************************************
+ * @brief Create an empty directory of programs in EEPROM.
+ *
+ * @param used The end of the bytes that are not erased (see @c eeprom_header).
+ *****************************************************************************/
+static void new_directory (uint16_t used)
+{
+        uint8_t index;
+
+        // slots first, header last
+        for (index = 0; index < EEPROM_SLOTS; index++)
+                free_slot (index);
+        header.magic = EEPROM_MAGIC;
+        header.version = EEPROM_VERSION;
+        header.used = used;
+        eeprom_update_block (&header, 0, sizeof (struct eeprom_header));
+}
+
+/** ***************************************************************************
+ * @brief Find the slot of the program named @c name.
+ *
+ * If there is no such program, the first free slot is returned instead (its
+ * format is @c SLOT_FREE).
+ *
+ * @param slot Where to store the slot.
+ * @return The index of the slot, @c EEPROM_SLOTS if there is no such program
+ * and no free slot either.
+ *****************************************************************************/
+static uint8_t find_slot (struct eeprom_slot *slot)
+{
+        uint8_t index, i;
+        uint8_t free = EEPROM_SLOTS;
+
+        for (index = 0; index < EEPROM_SLOTS; index++) {
+                read_slot (index, slot);
+                if (slot->format == SLOT_FREE) {
+                        if (free == EEPROM_SLOTS)
+                                free = index;
+                        continue;
+                }
+                for (i = 0; i < FILENAME_SIZE && slot->name[i] == name[i]; i++)
+                        ;
+                if (i == FILENAME_SIZE)
+                        return index;
+        }
+        if (free != EEPROM_SLOTS)
+                read_slot (free, slot);
+        return free;
+}
+
+/** ***************************************************************************
+ * @brief Read a slot of the directory.
+ *****************************************************************************/
+static void read_slot (uint8_t index, struct eeprom_slot *slot)
+{
+        eeprom_read_block (slot, (void *)EEPROM_SLOT (index), sizeof (struct eeprom_slot));
+}
+
+/** ***************************************************************************
+ * @brief Write a slot of the directory (at once, see rom_write_block()).
+ *****************************************************************************/
+static void write_slot (uint8_t index, struct eeprom_slot *slot)
+{
+        eeprom_update_block (slot, (void *)EEPROM_SLOT (index), sizeof (struct eeprom_slot));
+}
+
+/** ***************************************************************************
+ * @brief Mark a slot of the directory as free (only its format is written).
+ *****************************************************************************/
+static void free_slot (uint8_t index)
+{
+        eeprom_update_byte ((uint8_t *)EEPROM_SLOT (index), SLOT_FREE);
+}
+
+/** ***************************************************************************
+ * @brief Find free space for a program.
+ *
+ * The first space that is large enough is returned.
+ *
+ * @param length The size of the program.
+ * @param skip A slot whose program will be replaced (its space is free).
+ * @return The offset of the space, 0 if there is not enough space.
+ *****************************************************************************/
+static uint16_t find_space (uint16_t length, uint8_t skip)
+{
+        uint8_t index = 0;
+        uint16_t start = EEPROM_DATA;
+        struct eeprom_slot slot;
+
+        while (index < EEPROM_SLOTS) {
+                read_slot (index, &slot);
+                // space occupied by another program --> try right after it
+                if (index != skip && slot.format != SLOT_FREE &&
+                    slot.offset < start + length && start < slot.offset + slot.length) {
+                        start = slot.offset + slot.length;
+                        index = 0;
+                        continue;
+                }
+                index++;
+        }
+        if (start + length > E2END + 1)
+                return 0;
+        return start;
+}
+
+/** ***************************************************************************
+ * @brief Load the program named @c name.
+ *
+ * A program image is unpacked to the end of free memory, which is where the
+ * lines after the gap of program memory are (see merge_line()). A listing is
+ * read line by line, as if it was typed (see get_line()).
+ *
+ * @return The post-execution status.
+ *****************************************************************************/
+static uint8_t load_slot (void)
+{
+        uint8_t i;
+        struct eeprom_slot slot;
+
+        rom_wait();
+        if (!open_directory (0)) {
+                // no directory --> there might be a listing at the beginning
+                // (if the first byte is a number, assume there is a program)
+                if (name[0] == 0 && eeprom_read_byte (0) >= '0' && eeprom_read_byte (0) <= '9') {
+                        eeprom_ptr = 0;
+                        eeprom_end = E2END + 1;
+                        clear_program();
+                        sys_config |= cfg_from_eeprom;
+                } else
+                        error_code = 0x1B;
+        } else if (find_slot (&slot) == EEPROM_SLOTS || slot.format == SLOT_FREE)
+                error_code = 0x1B;
+        else if (slot.format == SLOT_LISTING) {
+                if (stored_checksum (slot.offset, slot.length) != slot.checksum)
+                        error_code = 0x19;
+                else {
+                        eeprom_ptr = slot.offset;
+                        eeprom_end = slot.offset + slot.length;
+                        clear_program();
+                        sys_config |= cfg_from_eeprom;
+                }
+        } else if (slot.format == SLOT_SNAPSHOT)
+                // the interpreter resumes it (see resume())
+                sys_config |= cfg_auto_run;
+        else {
+                clear_program();
+                drop_index();
+                if (slot.size > variables_ptr - program_space)
+                        error_code = 0x16;
+                else {
+                        tail_ptr = variables_ptr - slot.size;
+                        if (image_read (&slot, tail_ptr)) {
+                                clear_program();
+                                error_code = 0x19;
+                        }
+                }
+        }
+        if (error_code)
+                sys_config &= ~cfg_run_after_load;
+        else if (!(sys_config & cfg_auto_run))
+                // the program is known by its name (see overlay_begin())
+                for (i = 0; i < FILENAME_SIZE; i++)
+                        program_name[i] = name[i];
+        return POST_CMD_WARM_RESET;
+}
+
+/** ***************************************************************************
+ * @brief Save the program as @c name.
+ *
+ * A program that already has this name is replaced. The slot is written at
+ * once, the program itself in the background. Program images (and snapshots,
+ * the state first) are packed to free memory, past the room kept for the next
+ * line (see get_line()), and written from there (see rom_write_block()). If
+ * they do not fit, they are packed again, straight to EEPROM, and the program
+ * waits. Listings are written through the EEPROM stream (see putchar_rom()).
+ * A program that is cut short fails the checksum, when loaded.
+ *
+ * @param format Save a program image, a listing or a snapshot (see
+ * SLOT_FORMATS, snapshot()).
+ * @return The post-execution status.
+ *****************************************************************************/
+static uint8_t save_slot (uint8_t format)
+{
+        uint8_t index, i;
+        uint8_t *line, *unused;
+        uint16_t size;
+        struct eeprom_slot slot;
+
+        count_length = 0;
+        count_checksum = 0;
+        pack_room = 0;
+        if (format != SLOT_LISTING) {
+                // offsets of GOTO/GOSUB targets are not stored
+                unlink_program();
+                size = prog_end_ptr - program_space;
+                // the image saved before might be written from there still
+                rom_wait();
+                // the table takes the end of free memory, but not the line being executed (direct mode)
+                unused = prog_end_ptr;
+                if (text_ptr > prog_end_ptr) {
+                        for (unused = text_ptr; *unused != LF; unused++)
+                                ;
+                        unused++;
+                }
+                pack_buckets = PACK_BUCKETS;
+                while (pack_buckets > 0 && pack_buckets * PACK_WAYS * sizeof (uint16_t) > tail_ptr - unused)
+                        pack_buckets /= 2;
+                pack_table = (uint16_t *)tail_ptr - pack_buckets * PACK_WAYS;
+                // the packed image goes right before it (past the room for the next line)
+                pack_buffer = prog_end_ptr + STREAM_OFFSET;
+                if ((uint8_t *)pack_table > pack_buffer)
+                        pack_room = (uint8_t *)pack_table - pack_buffer;
+                if (format == SLOT_SNAPSHOT)
+                        snapshot_write (&stream_count);
+                image_pack (&stream_count);
+                count_checksum = 0;
+                if (format == SLOT_SNAPSHOT)
+                        count_checksum = image_checksum (image_checksum (0, (uint8_t *)&state, sizeof (struct snapshot_state)),
+                                                         stack_ptr, state.length - sizeof (struct snapshot_state));
+                count_checksum = image_checksum (count_checksum, program_space, size);
+        } else {
+                // print the listing once, just to measure it
+                for (line = program_space; line != prog_end_ptr; line += line[sizeof (LINE_NUMBER)])
+                        printline (line, NULL, &stream_count);
+                fputc (0, &stream_count);
+                size = count_length;
+        }
+
+        rom_wait();
+        open_directory (1);
+        index = find_slot (&slot);
+        if (index == EEPROM_SLOTS) {
+                error_code = 0x16;
+                return POST_CMD_WARM_RESET;
+        }
+        slot.offset = find_space (count_length, index);
+        if (slot.offset == 0) {
+                error_code = 0x16;
+                return POST_CMD_WARM_RESET;
+        }
+        for (i = 0; i < FILENAME_SIZE; i++)
+                slot.name[i] = name[i];
+        slot.format = format;
+        slot.length = count_length;
+        slot.size = size;
+        slot.checksum = count_checksum;
+        // the lines it holds (see overlay_load())
+        slot.first = 0;
+        slot.last = 0;
+        for (line = program_space; line != prog_end_ptr; line += line[sizeof (LINE_NUMBER)]) {
+                if (line == program_space)
+                        slot.first = *((LINE_NUMBER *)line);
+                slot.last = *((LINE_NUMBER *)line);
+        }
+        // the program goes past the bytes written so far --> record that first
+        if (slot.offset + slot.length > header.used) {
+                header.used = slot.offset + slot.length;
+                eeprom_update_block (&header, 0, sizeof (struct eeprom_header));
+        }
+        write_slot (index, &slot);
+
+        eeprom_ptr = slot.offset;
+        if (format == SLOT_LISTING) {
+                for (line = program_space; line != prog_end_ptr; line += line[sizeof (LINE_NUMBER)])
+                        printline (line, NULL, &stream_eeprom);
+                fputc (0, &stream_eeprom);
+        } else if (count_length <= pack_room) {
+                rom_write_block (pack_buffer, slot.offset, count_length);
+        } else {
+                if (format == SLOT_SNAPSHOT)
+                        snapshot_write (&stream_eeprom);
+                image_pack (&stream_eeprom);
+        }
+        // the program is known by its name from now on (see overlay_begin())
+        if (format != SLOT_SNAPSHOT)
+                for (i = 0; i < FILENAME_SIZE; i++)
+                        program_name[i] = name[i];
         return POST_CMD_NEXT_LINE;
 }
+
+/** ***************************************************************************
+ * @brief Calculate the checksum of a program image (CRC-16).
+ *
+ * @param crc The checksum of what precedes the image (0 if nothing).
+ *****************************************************************************/
+static uint16_t image_checksum (uint16_t crc, uint8_t *data, uint16_t length)
+{
+        while (length > 0) {
+                crc = _crc_xmodem_update (crc, *data);
+                data++;
+                length--;
+        }
+        return crc;
+}
+
+/** ***************************************************************************
+ * @brief Calculate the checksum of bytes stored in EEPROM (CRC-16).
+ *****************************************************************************/
+static uint16_t stored_checksum (uint16_t offset, uint16_t length)
+{
+        uint16_t crc = 0;
+        while (length > 0) {
+                crc = _crc_xmodem_update (crc, eeprom_read_byte ((uint8_t *)offset));
+                offset++;
+                length--;
+        }
+        return crc;
+}
+
+/** ***************************************************************************
+ * @brief Pack the program image (see @c PACK_MATCH).
+ *
+ * Every byte is repeated from the longest earlier match, if there is one of
+ * at least @c PACK_MIN_MATCH bytes, otherwise it is copied as it is. Matches
+ * are looked for only where the same first bytes were seen lately: a table
+ * keeps the last @c PACK_WAYS places of every hash of them (see
+ * pack_bucket()).
+ *
+ * @param stream Where to write the packed image.
+ *****************************************************************************/
+static void image_pack (FILE *stream)
+{
+        uint8_t *data = program_space;
+        uint8_t *literal = data;
+        uint8_t *candidate, *match = data;
+        uint16_t *bucket;
+        uint8_t length, best, way;
+        uint16_t distance;
+
+        for (bucket = pack_table; bucket != pack_table + pack_buckets * PACK_WAYS; bucket++)
+                *bucket = PACK_EMPTY;
+        while (data < prog_end_ptr) {
+                best = 0;
+                bucket = pack_bucket (data);
+                for (way = 0; bucket != NULL && way < PACK_WAYS && bucket[way] != PACK_EMPTY; way++) {
+                        // the places are kept from the latest one
+                        candidate = program_space + bucket[way];
+                        if (data - candidate > PACK_DISTANCE)
+                                break;
+                        // the bytes may overlap (unpacked one at a time)
+                        for (length = 0; length < PACK_MAX_MATCH && data + length < prog_end_ptr &&
+                             candidate[length] == data[length]; length++)
+                                ;
+                        if (length > best) {
+                                best = length;
+                                match = candidate;
+                        }
+                }
+                if (best >= PACK_MIN_MATCH) {
+                        pack_literals (literal, data, stream);
+                        distance = data - match - 1;
+                        fputc (PACK_MATCH | (best - PACK_MIN_MATCH) << 2 | distance >> 8, stream);
+                        fputc (distance & 0xFF, stream);
+                        // repeated bytes might be repeated again
+                        for ( ; best > 0; best--) {
+                                pack_insert (data);
+                                data++;
+                        }
+                        literal = data;
+                } else {
+                        pack_insert (data);
+                        data++;
+                        if (data - literal == PACK_LITERALS) {
+                                pack_literals (literal, data, stream);
+                                literal = data;
+                        }
+                }
+        }
+        pack_literals (literal, data, stream);
+}
+
+/** ***************************************************************************
+ * @brief Find the bucket of the table of image_pack() for some bytes.
+ *
+ * @return The places (offsets in program memory) where the first
+ * @c PACK_MIN_MATCH bytes had the same hash lately, NULL if there is no table
+ * or not enough bytes left.
+ *****************************************************************************/
+static uint16_t *pack_bucket (uint8_t *data)
+{
+        if (pack_buckets == 0 || prog_end_ptr - data < PACK_MIN_MATCH)
+                return NULL;
+        return pack_table + (((data[0] << 4) ^ (data[1] << 2) ^ data[2]) & (pack_buckets - 1)) * PACK_WAYS;
+}
+
+/** ***************************************************************************
+ * @brief Remember where some bytes are, in the table of image_pack().
+ *
+ * The oldest place of the bucket is dropped.
+ *****************************************************************************/
+static void pack_insert (uint8_t *data)
+{
+        uint16_t *bucket = pack_bucket (data);
+        uint8_t way;
+
+        if (bucket == NULL)
+                return;
+        for (way = PACK_WAYS - 1; way > 0; way--)
+                bucket[way] = bucket[way - 1];
+        bucket[0] = data - program_space;
+}
+
+/** ***************************************************************************
+ * @brief Write bytes of a packed image, as they are.
+ *****************************************************************************/
+static void pack_literals (uint8_t *data, uint8_t *end, FILE *stream)
+{
+        if (data == end)
+                return;
+        fputc (end - data - 1, stream);
+        while (data < end) {
+                fputc (*data, stream);
+                data++;
+        }
+}
+
+/** ***************************************************************************
+ * @brief Unpack a program image stored in EEPROM.
+ *
+ * @param slot The slot of the program.
+ * @param data Where to unpack it (@c slot->size bytes).
+ * @return Non-zero if the packed image is not valid.
+ *****************************************************************************/
+static uint8_t image_unpack (struct eeprom_slot *slot, uint8_t *data)
+{
+        uint8_t *start = data;
+        uint8_t *end = data + slot->size;
+        uint16_t offset = slot->offset;
+        uint16_t stop = slot->offset + slot->length;
+        uint16_t distance;
+        uint8_t code, count;
+
+        while (offset < stop) {
+                code = eeprom_read_byte ((uint8_t *)offset);
+                offset++;
+                if (code >= PACK_MATCH) {
+                        // repeat bytes already unpacked
+                        distance = ((code & 0x03) << 8 | eeprom_read_byte ((uint8_t *)offset)) + 1;
+                        offset++;
+                        count = ((code & ~PACK_MATCH) >> 2) + PACK_MIN_MATCH;
+                        if (distance > data - start || count > end - data)
+                                return 1;
+                        while (count > 0) {
+                                *data = *(data - distance);
+                                data++;
+                                count--;
+                        }
+                } else {
+                        // copy bytes as they are
+                        count = code + 1;
+                        if (count > end - data || count > stop - offset)
+                                return 1;
+                        eeprom_read_block (data, (void *)offset, count);
+                        data += count;
+                        offset += count;
+                }
+        }
+        return data != end;
+}
+
+/** ***************************************************************************
+ * @brief Unpack a program image stored in EEPROM and verify it.
+ *
+ * The image of a snapshot follows the state of the interpreter, which is
+ * covered by the checksum as well (see snapshot()).
+ *
+ * @param slot The slot of the program.
+ * @param data Where to unpack it (@c slot->size bytes).
+ * @return Non-zero if the image is not valid.
+ *****************************************************************************/
+static uint8_t image_read (struct eeprom_slot *slot, uint8_t *data)
+{
+        struct eeprom_slot image = *slot;
+        uint16_t crc = 0;
+        uint16_t length;
+
+        if (slot->format == SLOT_SNAPSHOT) {
+                length = eeprom_read_word ((uint16_t *)slot->offset);
+                if (length > slot->length)
+                        return 1;
+                crc = stored_checksum (slot->offset, length);
+                image.offset += length;
+                image.length -= length;
+        }
+        return image_unpack (&image, data) || image_checksum (crc, data, slot->size) != slot->checksum;
+}
+
+/** ***************************************************************************
+ * @brief Write the state of the interpreter and the stack (see snapshot()).
+ *****************************************************************************/
+static void snapshot_write (FILE *stream)
+{
+        uint8_t *data = (uint8_t *)&state;
+        uint16_t i;
+
+        for (i = 0; i < sizeof (struct snapshot_state); i++)
+                fputc (data[i], stream);
+        for (i = 0; i < state.length - sizeof (struct snapshot_state); i++)
+                fputc (stack_ptr[i], stream);
+}
+
+/** ***************************************************************************
+ * @brief List a program image stored in EEPROM.
+ *
+ * The image is unpacked to free memory, right after the program, and its
+ * lines are printed from there.
+ *
+ * @param slot The slot of the program.
+ *****************************************************************************/
+static void image_list (struct eeprom_slot *slot)
+{
+        uint8_t *line = prog_end_ptr;
+        uint8_t *end = prog_end_ptr + slot->size;
+
+        if (slot->size > tail_ptr - prog_end_ptr) {
+                error_code = 0x16;
+                return;
+        }
+        if (image_read (slot, prog_end_ptr)) {
+                error_code = 0x19;
+                return;
+        }
+        while (line < end) {
+                printline (line, NULL, stdout);
+                line += line[sizeof (LINE_NUMBER)];
+        }
+}
+
+/** ***************************************************************************
+ * @brief Print the size of a program in memory and in EEPROM.
+ *****************************************************************************/
+static void print_sizes (struct eeprom_slot *slot)
+{
+        printnum (slot->size, stdout);
+        printmsg_noNL (msg_bytes, stdout);
+        if (slot->format == SLOT_LISTING)
+                printmsg_noNL (msg_listing, stdout);
+        else {
+                fputc (' ', stdout);
+                fputc ('(', stdout);
+                printnum (slot->length, stdout);
+                printmsg_noNL (msg_packed, stdout);
+        }
+        newline (stdout);
+}
+
+/** ***************************************************************************
+ * @brief Count a character of a listing or a packed image (see save_slot()).
+ *****************************************************************************/
+static int count_char (char chr, FILE *stream)
+{
+        // keep the packed image, as long as it fits
+        if (count_length < pack_room)
+                pack_buffer[count_length] = chr;
+        count_length++;
+        count_checksum = _crc_xmodem_update (count_checksum, chr);
+        return 0;
+}
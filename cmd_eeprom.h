@@ -20,6 +20,8 @@
 #ifndef CMD_EEPROM_H
 #define CMD_EEPROM_H
 
+#include <util/crc16.h>
+
 #include "interpreter.h"
 #include "parser.h"
 
@@ -27,5 +29,119 @@ uint8_t elist (void);
 uint8_t eformat (void);
 uint8_t eload (void);
 uint8_t esave (void);
+uint8_t echain (void);
+uint8_t files (void);
+uint8_t cformat (void);
+uint8_t cload (void);
+uint8_t csave (void);
+uint8_t cchain (void);
+uint8_t esync (void);
+uint16_t files_free (void);
+uint16_t files_stored (uint16_t *packed);
+uint8_t overlay_begin (void);
+uint8_t overlay_load (void);
+void overlay_end (void);
+uint8_t snapshot (void);
+uint8_t find_snapshot (void);
+uint8_t resume (void);
+
+/** The maximum length of a file name (see valid_filename()). */
+#define FILENAME_SIZE   8
+
+/** The name of the program in memory, if it was loaded or saved by name (see overlay_begin()). */
+uint8_t program_name[FILENAME_SIZE];
+
+/**
+ * The EEPROM holds a directory of programs: a header, followed by
+ * @c EEPROM_SLOTS slots, one for every program. The programs are stored
+ * anywhere after the directory, either as a packed image of program memory
+ * (tokenized, with line numbers and lengths, see @c PACK_MATCH) or as a
+ * listing (text, ends with NULL). The program of ESAVE/ELOAD has no name (all zeros).
+ *
+ * The header also records how much of the EEPROM has been written since it
+ * was last erased (see EFORMAT): everything after that is erased already.
+ */
+struct eeprom_header {
+        uint16_t magic;                 // EEPROM_MAGIC
+        uint8_t version;                // EEPROM_VERSION
+        uint16_t used;                  // bytes written since EFORMAT
+};
+
+/** A slot of the directory (see @c eeprom_header). */
+struct eeprom_slot {
+        uint8_t format;                 // see SLOT_FORMATS
+        uint8_t name[FILENAME_SIZE];    // padded with zeros
+        uint16_t offset;                // where the program begins
+        uint16_t length;                // bytes of program in EEPROM
+        uint16_t size;                  // bytes of program in memory
+        uint16_t checksum;              // CRC-16 of the program (in memory)
+        uint16_t first;                 // the first line number of a program image
+        uint16_t last;                  // the last line number of a program image
+};
+
+enum SLOT_FORMATS {
+        SLOT_FREE = 0,
+        SLOT_IMAGE,
+        SLOT_LISTING,
+        SLOT_SNAPSHOT
+};
+
+/**
+ * A snapshot (see SNAPSHOT) begins with the state of the interpreter, followed
+ * by the stack and the packed image of the program. Pointers (in the stack as
+ * well) are stored as offsets in program memory. The checksum of the slot
+ * covers all of them.
+ */
+struct snapshot_state {
+        uint16_t length;                // bytes of state and stack
+        uint16_t line;                  // the line to resume (SNAPSHOT_NONE: run from the beginning)
+        uint16_t text;                  // the statement to resume
+        uint16_t overlay;               // where overlays are loaded (SNAPSHOT_NONE: no overlays)
+        uint8_t overlay_slot;
+        uint16_t overlay_line;
+        uint8_t name[FILENAME_SIZE];    // the name of the program (see program_name)
+        uint8_t for_frames[26];
+        int16_t variables[27];
+};
+
+/** Marks the directory -- its first byte is not a digit, as in a listing. */
+#define EEPROM_MAGIC    ('n' | 'B' << 8)
+/** The format of the directory and program images (should change along with tokens, see keywords.def). */
+#define EEPROM_VERSION  13
+/** The number of programs in EEPROM. */
+#define EEPROM_SLOTS    8
+/** The address of a slot. */
+#define EEPROM_SLOT(i)  (sizeof (struct eeprom_header) + (i) * sizeof (struct eeprom_slot))
+/** Where programs are stored (right after the directory). */
+#define EEPROM_DATA     EEPROM_SLOT (EEPROM_SLOTS)
+/** The name of the snapshot in the directory. */
+#define SNAPSHOT_NAME   "SNAPSHOT"
+/** No offset is stored (see @c snapshot_state). */
+#define SNAPSHOT_NONE   0xFFFF
+/** The value of an erased EEPROM byte. */
+#define EEPROM_ERASED   0xFF
+
+/**
+ * Program images are packed: a byte below @c PACK_MATCH is followed by that
+ * many bytes plus one, to be copied as they are. A byte from @c PACK_MATCH up
+ * is followed by another one; together they repeat some bytes that have
+ * already been unpacked: 5 bits hold their number (minus @c PACK_MIN_MATCH)
+ * and 10 bits how far back they are (minus one).
+ */
+#define PACK_MATCH      0x80
+/** The most bytes copied as they are at once. */
+#define PACK_LITERALS   PACK_MATCH
+/** The fewest bytes worth repeating. */
+#define PACK_MIN_MATCH  3
+/** The most bytes repeated at once. */
+#define PACK_MAX_MATCH  (PACK_MIN_MATCH + 31)
+/** How far back the repeated bytes may be. */
+#define PACK_DISTANCE   1024
+/** The most buckets of the table that finds earlier matches (see image_pack()). */
+#define PACK_BUCKETS    64
+/** How many earlier bytes every bucket remembers. */
+#define PACK_WAYS       4
+/** An unused place of a bucket. */
+#define PACK_EMPTY      0xFFFF
 
 #endif
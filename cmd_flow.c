@@ -19,21 +19,33 @@
 
 #include "cmd_flow.h"
 
+static uint8_t *jump_target (void);
+static uint8_t **frame_jump (uint8_t *frame);
+static uint8_t unpark_frame (uint8_t *frame);
+
 uint8_t gotoline (void)
 {
-    line_number = parse_expr_s1();
+    // target resolved by link_program()
+    ignorespace();
+    if (*text_ptr == TOK_LINK) {
+        line_ptr = program_space + *((uint16_t *)(text_ptr + 1));
+        return POST_CMD_EXEC_LINE;
+    }
+    line_number = parse_expr();
     if (error_code || *text_ptr != LF) {
         error_code = 0x4;
         return POST_CMD_WARM_RESET;
     }
-    line_ptr = find_line();
+    line_ptr = jump_target();
+    if (error_code)
+        return POST_CMD_WARM_RESET;
     return POST_CMD_EXEC_LINE;
 }
 
 uint8_t check (void)
 {
     uint16_t value;
-    value = parse_expr_s1();
+    value = parse_expr();
     if (error_code || *text_ptr == LF) {
         error_code = 0x4;
         return POST_CMD_WARM_RESET;
@@ -49,6 +61,7 @@ uint8_t loopfor (void)
         uint8_t index;
                 uint8_t var;
                 uint16_t initial, step, terminal;
+                struct stack_for_frame *f;
                 ignorespace();
                 if (*text_ptr < 'A' || *text_ptr > 'Z') {
                         error_code = 0x7;
@@ -57,29 +70,29 @@ uint8_t loopfor (void)
                 var = *text_ptr;
                 text_ptr++;
                 ignorespace();
-                if (*text_ptr != '=') {
+                if (*text_ptr != TOK_EQ) {
                         error_code = 0xA;
             return POST_CMD_WARM_RESET;
                 }
                 text_ptr++;
                 ignorespace();
                 error_code = 0;
-                initial = parse_expr_s1();
+                initial = parse_expr();
                 if (error_code) {
             return POST_CMD_WARM_RESET;
         }
-                index = scantable (to_tab);
+                index = scantoken (TOK_TO, 1);
                 if (index != 0) {
                         error_code = 0x2;
             return POST_CMD_WARM_RESET;
                 }
-                terminal = parse_expr_s1();
+                terminal = parse_expr();
                 if (error_code) {
             return POST_CMD_WARM_RESET;
         }
-        index = scantable (step_tab);
+        index = scantoken (TOK_STEP, 1);
                 if (index == 0) {
-                        step = parse_expr_s1();
+                        step = parse_expr();
                         if (error_code) {
                 return POST_CMD_WARM_RESET;
             }
@@ -89,43 +102,41 @@ uint8_t loopfor (void)
                         error_code = 0x2;
             return POST_CMD_WARM_RESET;
                 }
-                if (!error_code && *text_ptr == LF) {
-                        struct stack_for_frame *f;
-                        if (stack_ptr + sizeof (struct stack_for_frame) < stack_limit) {
-                                error_code = 0x3;
-                return POST_CMD_WARM_RESET;
-                        }
-                        stack_ptr -= sizeof (struct stack_for_frame);
-                        f = (struct stack_for_frame *)stack_ptr;
-                        ((uint16_t *)variables_ptr)[var - 'A'] = initial;
-                        f->frame_type = STACK_FOR_FLAG;
-                        f->for_var = var;
-                        f->terminal = terminal;
-                        f->step = step;
-                        f->text_ptr = text_ptr;
-                        f->line_ptr = line_ptr;
-                        return POST_CMD_NEXT_STATEMENT;
-                }
-        error_code = 0x4;
-    return POST_CMD_WARM_RESET;
+                // the loop begins right after FOR -- either in the same line (colon) or in the next one
+                f = push_for_frame (var);
+                if (f == NULL)
+            return POST_CMD_WARM_RESET;
+                ((uint16_t *)variables_ptr)[var - 'A'] = initial;
+                f->terminal = terminal;
+                f->step = step;
+                f->text_ptr = text_ptr;
+                f->line_ptr = line_ptr;
+                return POST_CMD_NEXT_STATEMENT;
 }
 
 uint8_t gosub (void)
 {
+        uint8_t *target = NULL;
         error_code = 0;
-        line_number = parse_expr_s1();
+        // target resolved by link_program()
+        ignorespace();
+        if (*text_ptr == TOK_LINK) {
+                target = program_space + *((uint16_t *)(text_ptr + 1));
+                text_ptr += 3;
+                ignorespace();
+        } else
+                line_number = parse_expr();
         if (!error_code && *text_ptr == LF) {
                 struct stack_gosub_frame *f;
-                if (stack_ptr + sizeof (struct stack_gosub_frame) < stack_limit) {
-                        error_code = 0x3;
+                f = (struct stack_gosub_frame *)push_frame (sizeof (struct stack_gosub_frame));
+                if (f == NULL)
             return POST_CMD_WARM_RESET;
-                }
-                stack_ptr -= sizeof (struct stack_gosub_frame);
-                f = (struct stack_gosub_frame *)stack_ptr;
                 f->frame_type = STACK_GOSUB_FLAG;
                 f->text_ptr = text_ptr;
                 f->line_ptr = line_ptr;
-                line_ptr = find_line();
+                line_ptr = target ? target : jump_target();
+                if (error_code)
+                        return POST_CMD_WARM_RESET;
                 return POST_CMD_EXEC_LINE;
         }
         error_code = 0x4;
@@ -134,69 +145,314 @@ uint8_t gosub (void)
 
 uint8_t next (void)
 {
+        uint8_t var;
+
         // find the variable name
         ignorespace();
         if (*text_ptr < 'A' || *text_ptr > 'Z') {
                 error_code = 0x7;
         return POST_CMD_WARM_RESET;
         }
+        var = *text_ptr;
         text_ptr++;
         ignorespace();
         if (*text_ptr != ':' && *text_ptr != LF) {
                 error_code = 0x2;
         return POST_CMD_WARM_RESET;
         }
-    return POST_CMD_NOTHING;
+    return gosub_return (CMD_NEXT, var);
+}
+
+uint8_t subreturn (void)
+{
+    return gosub_return (CMD_RETURN, 0);
+}
+
+uint8_t gosub_return (uint8_t cmd, uint8_t var)
+{
+        uint8_t *frame;
+
+        frame = unwind_stack (cmd, var);
+        if (error_code)
+        return POST_CMD_WARM_RESET;
+        // the jump point is in an overlay that has been swapped out
+        if (frame != NULL && (frame[0] & STACK_SWAPPED) && unpark_frame (frame))
+                return POST_CMD_WARM_RESET;
+        // jump back to the GOSUB statement or to the beginning of the loop
+        if (frame != NULL && cmd == CMD_RETURN) {
+                line_ptr = ((struct stack_gosub_frame *)frame)->line_ptr;
+                text_ptr = ((struct stack_gosub_frame *)frame)->text_ptr;
+        }
+        if (frame != NULL && cmd == CMD_NEXT) {
+                line_ptr = ((struct stack_for_frame *)frame)->line_ptr;
+                text_ptr = ((struct stack_for_frame *)frame)->text_ptr;
+        }
+    return POST_CMD_NEXT_STATEMENT;
+}
+
+/** ***************************************************************************
+ * @brief Empty the stack.
+ *
+ * This function drops all GOSUB and FOR frames, along with the index of
+ * FOR frames.
+ *****************************************************************************/
+void reset_stack (void)
+{
+        uint8_t var;
+
+        stack_ptr = program_space + MEMORY_SIZE;
+        for (var = 0; var < 26; var++)
+                for_frames[var] = 0;
+}
+
+/** ***************************************************************************
+ * @brief Reserve a new stack frame.
+ *
+ * This function is used by GOSUB and FOR to store their jump points.
+ *
+ * @param size The size of the frame.
+ * @return Pointer to the new frame, or NULL if the stack is full.
+ *****************************************************************************/
+uint8_t *push_frame (uint8_t size)
+{
+        if (stack_ptr - size < stack_limit) {
+                error_code = 0x3;
+                return NULL;
+        }
+        stack_ptr -= size;
+        return stack_ptr;
+}
+
+/** ***************************************************************************
+ * @brief Reserve a new FOR frame.
+ *
+ * The new frame becomes the innermost loop of the specified variable, so NEXT
+ * finds it without searching the stack (see @c for_frames).
+ *
+ * @param var The name of the loop variable.
+ * @return Pointer to the new frame, or NULL if the stack is full.
+ *****************************************************************************/
+struct stack_for_frame *push_for_frame (uint8_t var)
+{
+        struct stack_for_frame *f;
+
+        f = (struct stack_for_frame *)push_frame (sizeof (struct stack_for_frame));
+        if (f == NULL)
+                return NULL;
+        f->frame_type = STACK_FOR_FLAG;
+        f->for_var = var;
+        for_frames[var - 'A'] = program_space + MEMORY_SIZE - (uint8_t *)f;
+        return f;
+}
+
+/** ***************************************************************************
+ * @brief Pop stack frames.
+ *
+ * Every FOR frame that is popped is also removed from @c for_frames.
+ *
+ * @param ptr The new value of @c stack_ptr.
+ *****************************************************************************/
+static void pop_frames (uint8_t *ptr)
+{
+        while (stack_ptr < ptr) {
+                if ((stack_ptr[0] & ~STACK_SWAPPED) == STACK_FOR_FLAG) {
+                        for_frames[stack_ptr[1] - 'A'] = 0;
+                        stack_ptr += sizeof (struct stack_for_frame);
+                } else
+                        stack_ptr += sizeof (struct stack_gosub_frame);
+        }
 }
 
-uint8_t gosub_return (uint8_t cmd)
+/** ***************************************************************************
+ * @brief Find the frame of a RETURN or NEXT statement.
+ *
+ * This function walks up the stack frames. For RETURN, it finds the frame of
+ * the innermost GOSUB and pops it (along with any unfinished loops). For NEXT,
+ * it finds the loop of the specified variable and updates the variable. If
+ * the loop is over, the frame is popped. The loop of a variable is searched
+ * only once; after that, it is found through @c for_frames.
+ *
+ * @param cmd Either @c CMD_RETURN or @c CMD_NEXT.
+ * @param var The name of the loop variable (NEXT only, 'A' to 'Z').
+ * @return Pointer to the frame with the jump point, or NULL if execution
+ * should proceed with the next statement (or on error).
+ *****************************************************************************/
+uint8_t *unwind_stack (uint8_t cmd, uint8_t var)
 {
     uint8_t *tmp_stack_ptr;
+        struct stack_for_frame *f = NULL;
+        uint16_t *varaddr;
+
+        if (cmd == CMD_NEXT && (var < 'A' || var > 'Z')) {
+                error_code = 0x7;
+                return NULL;
+        }
+        // innermost loop of the variable is known --> no need to search
+        if (cmd == CMD_NEXT && for_frames[var - 'A'] != 0)
+                f = (struct stack_for_frame *)(program_space + MEMORY_SIZE - for_frames[var - 'A']);
 
         // walk up the stack frames and find the frame we want -- if present
         tmp_stack_ptr = stack_ptr;
-        while (tmp_stack_ptr < program_space + MEMORY_SIZE - 1) {
-                switch (tmp_stack_ptr[0]) {
+        while (f == NULL && tmp_stack_ptr < program_space + MEMORY_SIZE - 1) {
+                switch (tmp_stack_ptr[0] & ~STACK_SWAPPED) {
                 case STACK_GOSUB_FLAG:
                         if (cmd == CMD_RETURN) {
-                                struct stack_gosub_frame *f = (struct stack_gosub_frame *)tmp_stack_ptr;
-                                line_ptr    = f->line_ptr;
-                                text_ptr                  = f->text_ptr;
-                                stack_ptr += sizeof (struct stack_gosub_frame);
-                                return POST_CMD_NEXT_STATEMENT;
+                                pop_frames (tmp_stack_ptr + sizeof (struct stack_gosub_frame));
+                                return tmp_stack_ptr;
                         }
                         // This is not the loop you are looking for... go up in the stack
                         tmp_stack_ptr += sizeof (struct stack_gosub_frame);
                         break;
                 case STACK_FOR_FLAG:
                         // Flag, Var, Final, Step
-                        if (cmd == CMD_NEXT) {
-                                struct stack_for_frame *f = (struct stack_for_frame *)tmp_stack_ptr;
-                                // Is the variable we are looking for?
-                                if (text_ptr[-1] == f->for_var) {
-                                        uint16_t *varaddr = ((uint16_t *)variables_ptr) + text_ptr[-1] - 'A';
-                                        *varaddr = *varaddr + f->step;
-                                        // Use a different test depending on the sign of the step increment
-                                        if ((f->step > 0 && *varaddr <= f->terminal) || (f->step < 0 && *varaddr >= f->terminal)) {
-                                                // We have to loop so don't pop the stack
-                                                text_ptr = f->text_ptr;
-                                                line_ptr = f->line_ptr;
-                                                return POST_CMD_NEXT_STATEMENT;
-                                        }
-                                        // We've run to the end of the loop. drop out of the loop, popping the stack
-                                        stack_ptr = tmp_stack_ptr + sizeof (struct stack_for_frame);
-                                        return POST_CMD_NEXT_STATEMENT;
-                                }
+                        // Is the variable we are looking for?
+                        if (cmd == CMD_NEXT && var == tmp_stack_ptr[1]) {
+                                f = (struct stack_for_frame *)tmp_stack_ptr;
+                                for_frames[var - 'A'] = program_space + MEMORY_SIZE - tmp_stack_ptr;
+                                break;
                         }
                         // This is not the loop you are looking for... go up in the stack
                         tmp_stack_ptr += sizeof (struct stack_for_frame);
                         break;
                 default:
-                        //printf( "Stack is full!\n" );
-            return POST_CMD_WARM_RESET;
+                        tmp_stack_ptr = program_space + MEMORY_SIZE;
+                        break;
                 }
         }
         // cannot find the return point
-        error_code = 0x8;
-    return POST_CMD_WARM_RESET;
+        if (f == NULL) {
+                error_code = 0x8;
+                return NULL;
+        }
+
+        varaddr = ((uint16_t *)variables_ptr) + var - 'A';
+        *varaddr = *varaddr + f->step;
+        // Use a different test depending on the sign of the step increment
+        if ((f->step > 0 && *varaddr <= f->terminal) || (f->step < 0 && *varaddr >= f->terminal)) {
+                // We have to loop so don't pop the stack
+                return (uint8_t *)f;
+        }
+        // We've run to the end of the loop. drop out of the loop, popping the stack
+        pop_frames ((uint8_t *)f + sizeof (struct stack_for_frame));
+        return NULL;
+}
+
+/** ***************************************************************************
+ * @brief Find the target line of GOTO/GOSUB.
+ *
+ * If there is no line numbered @c line_number, the overlay that holds it is
+ * loaded (see overlay_load()).
+ *
+ * @return The target line (see find_line()).
+ *****************************************************************************/
+static uint8_t *jump_target (void)
+{
+        uint8_t *line;
+
+        line = find_line();
+        if ((line == prog_end_ptr || *((LINE_NUMBER *)line) != line_number) && overlay_load())
+                line = find_line();
+        return line;
+}
+
+/** ***************************************************************************
+ * @brief Get the jump point of a stack frame.
+ *
+ * @return Pointer to the @c line_ptr of the frame (followed by @c text_ptr,
+ * in both kinds of frames).
+ *****************************************************************************/
+static uint8_t **frame_jump (uint8_t *frame)
+{
+        if ((frame[0] & ~STACK_SWAPPED) == STACK_FOR_FLAG)
+                return &((struct stack_for_frame *)frame)->line_ptr;
+        return &((struct stack_gosub_frame *)frame)->line_ptr;
+}
+
+/** ***************************************************************************
+ * @brief Keep the jump points of frames that are about to be swapped out.
+ *
+ * This function is called before an overlay is replaced (see overlay_load()).
+ * The jump point of every frame in a line from @c line on is stored as the
+ * number of the line and the offset in it, and the frame is marked with
+ * @c STACK_SWAPPED, so that the pointers are found again when needed.
+ *
+ * @param line The first line that is swapped out.
+ *****************************************************************************/
+void park_frames (uint8_t *line)
+{
+        uint8_t *frame = stack_ptr;
+        uint8_t **jump;
+
+        while (frame < program_space + MEMORY_SIZE) {
+                jump = frame_jump (frame);
+                if (!(frame[0] & STACK_SWAPPED) && jump[0] >= line) {
+                        jump[1] = (uint8_t *)(uintptr_t)(jump[1] - jump[0]);
+                        jump[0] = (uint8_t *)(uintptr_t)*((LINE_NUMBER *)jump[0]);
+                        frame[0] |= STACK_SWAPPED;
+                }
+                if ((frame[0] & ~STACK_SWAPPED) == STACK_FOR_FLAG)
+                        frame += sizeof (struct stack_for_frame);
+                else
+                        frame += sizeof (struct stack_gosub_frame);
+        }
+}
+
+/** ***************************************************************************
+ * @brief Restore the jump point of a frame that has been swapped out.
+ *
+ * The overlay that holds the line of the frame is loaded again (see
+ * park_frames()).
+ *
+ * @return Non-zero if the line cannot be found.
+ *****************************************************************************/
+static uint8_t unpark_frame (uint8_t *frame)
+{
+        uint8_t **jump = frame_jump (frame);
+        uint8_t *line;
+
+        line_number = (uintptr_t)jump[0];
+        overlay_load();
+        if (error_code)
+                return 1;
+        line = find_line();
+        if (line == prog_end_ptr || *((LINE_NUMBER *)line) != line_number) {
+                error_code = 0x8;
+                return 1;
+        }
+        jump[1] = line + (uintptr_t)jump[1];
+        jump[0] = line;
+        frame[0] &= ~STACK_SWAPPED;
+        return 0;
+}
+
+/** ***************************************************************************
+ * @brief Convert the jump points of the stack frames to offsets (or back).
+ *
+ * This function is used to store the stack in EEPROM (see snapshot()).
+ * Frames that have been swapped out keep line numbers, not pointers.
+ *
+ * @param to_offsets Non-zero to convert pointers to offsets in program
+ * memory, zero to convert offsets to pointers.
+ *****************************************************************************/
+void relocate_frames (uint8_t to_offsets)
+{
+        uint8_t *frame = stack_ptr;
+        uint8_t **jump;
+
+        while (frame < program_space + MEMORY_SIZE) {
+                jump = frame_jump (frame);
+                if (!(frame[0] & STACK_SWAPPED)) {
+                        if (to_offsets) {
+                                jump[0] = (uint8_t *)(uintptr_t)(jump[0] - program_space);
+                                jump[1] = (uint8_t *)(uintptr_t)(jump[1] - program_space);
+                        } else {
+                                jump[0] = program_space + (uintptr_t)jump[0];
+                                jump[1] = program_space + (uintptr_t)jump[1];
+                        }
+                }
+                if ((frame[0] & ~STACK_SWAPPED) == STACK_FOR_FLAG)
+                        frame += sizeof (struct stack_for_frame);
+                else
+                        frame += sizeof (struct stack_gosub_frame);
+        }
 }
@@ -29,6 +29,13 @@ uint8_t check (void);
 uint8_t loopfor (void);
 uint8_t gosub (void);
 uint8_t next (void);
-uint8_t gosub_return (uint8_t cmd);
+uint8_t subreturn (void);
+uint8_t gosub_return (uint8_t cmd, uint8_t var);
+void reset_stack (void);
+uint8_t *push_frame (uint8_t size);
+struct stack_for_frame *push_for_frame (uint8_t var);
+uint8_t *unwind_stack (uint8_t cmd, uint8_t var);
+void park_frames (uint8_t *line);
+void relocate_frames (uint8_t to_offsets);
 
 #endif
@@ -18,8 +18,9 @@
  */
 
 #include "cmd_other.h"
+#include "bytecode.h"
 
-int8_t input (void)
+uint8_t input (void)
 {
     uint8_t chr = 0;
     uint8_t cnt = 0;
@@ -93,7 +94,7 @@ int8_t input (void)
         return POST_CMD_NEXT_STATEMENT;
 }
 
-int8_t assignment (void)
+uint8_t assignment (void)
 {
         int16_t value, *var;
         // check if invalid character (non-letter)
@@ -113,13 +114,13 @@ int8_t assignment (void)
 
         // check for missing assignment operator
         ignorespace();
-        if (*text_ptr != '=') {
+        if (*text_ptr != TOK_EQ) {
                 error_code = 0xf;
                 return POST_CMD_WARM_RESET;
         }
         text_ptr++;
         ignorespace();
-        value = parse_expr_s1();
+        value = parse_expr();
         if (error_code)
                 return POST_CMD_WARM_RESET;
         // check if at the end of the statement
@@ -131,11 +132,11 @@ int8_t assignment (void)
         return POST_CMD_NEXT_STATEMENT;
 }
 
-int8_t poke (void)
+uint8_t poke (void)
 {
     int16_t value, address;
     // get the address
-    address = parse_expr_s1();
+    address = parse_expr();
     if (error_code) {
         return POST_CMD_WARM_RESET;
     }
@@ -152,7 +153,7 @@ int8_t poke (void)
     text_ptr++;
     // get the value to assign
     ignorespace();
-    value = parse_expr_s1();
+    value = parse_expr();
     if (error_code) {
         return POST_CMD_WARM_RESET;
     }
@@ -170,7 +171,7 @@ int8_t poke (void)
         return POST_CMD_NEXT_STATEMENT;
 }
 
-int8_t list (void)
+uint8_t list (void)
 {
         line_number = get_line_numberber();
 
@@ -183,50 +184,84 @@ int8_t list (void)
         uint8_t *line = find_line();
         LINE_LENGTH length = 0;
         while (line != prog_end_ptr) {
-                printline (line, stdout);
+                printline (line, NULL, stdout);
                 length = (LINE_LENGTH) (*(line + sizeof (LINE_NUMBER)));
                 line += length;
         }
         return POST_CMD_WARM_RESET;
 }
 
-int8_t mem (void)
+uint8_t mem (void)
 {
+        uint16_t packed;
+
         // SRAM size
         printnum (variables_ptr - prog_end_ptr, stdout);
         printmsg (msg_ram_bytes, stdout);
         // EEPROM size
         printnum (E2END + 1, stdout);
         printmsg (msg_rom_bytes, stdout);
-        // EEPROM usage
-        //uint8_t val = 127;
-        //uint16_t i;
-        //for( i = 0; ( i < ( E2END + 1 ) ) && ( val != '\0' ); i++ )
-                //val = eeprom_read_byte( (uint8_t *)i );
-        //printnum( ( E2END + 1 ) - ( i - 1 ), stdout );
-        //printmsg( msg_available, stdout );
+        // EEPROM usage (see files())
+        printnum (files_free(), stdout);
+        printmsg (msg_available, stdout);
+        // programs stored in EEPROM (their size in memory and packed)
+        printnum (files_stored (&packed), stdout);
+        printmsg_noNL (msg_stored, stdout);
+        fputc (' ', stdout);
+        fputc ('(', stdout);
+        printnum (packed, stdout);
+        printmsg (msg_packed, stdout);
+        // serial receiver (the most bytes waiting and the bytes lost)
+        printnum (ser_high_water, stdout);
+        printmsg_noNL (msg_buffered, stdout);
+        fputc (' ', stdout);
+        fputc ('(', stdout);
+        printnum (ser_overruns, stdout);
+        printmsg (msg_lost, stdout);
         return POST_CMD_NEXT_STATEMENT;
 }
 
-int8_t randomize (void)
+uint8_t randomize (void)
 {
         srand (TCNT2);
         return POST_CMD_NEXT_STATEMENT;
 }
 
-int8_t rndseed (void)
+uint8_t rndseed (void)
 {
         uint16_t param;
         error_code = 0;
         // get seed for PRNG
-        param = (uint16_t)parse_expr_s1();
+        param = (uint16_t)parse_expr();
         if (error_code)
                 return POST_CMD_WARM_RESET;
         srand (param);
         return POST_CMD_NEXT_STATEMENT;
 }
 
-int8_t prog_run (void)
+uint8_t prog_delay (void)
+{
+        uint16_t value;
+        value = parse_expr();
+        if (error_code)
+                return POST_CMD_WARM_RESET;
+        fx_delay_ms (value);
+        return POST_CMD_NEXT_STATEMENT;
+}
+
+uint8_t remark (void)
+{
+        // ignore the rest of the line
+        return POST_CMD_NEXT_LINE;
+}
+
+uint8_t not_implemented (void)
+{
+        error_code = 0x1;
+        return POST_CMD_WARM_RESET;
+}
+
+uint8_t prog_run (void)
 {
         //enable emergency break key (INT2)
         EIMSK |= BREAK_INT;
@@ -234,11 +269,35 @@ int8_t prog_run (void)
         putchar (vid_cursor_off);
         // disable auto scroll
         putchar (vid_scroll_off);
+        // resolve GOTO/GOSUB targets (and rebuild line index, if needed)
+        link_program();
+        // overlays might be loaded --> only the text interpreter swaps them
+        if (!overlay_begin()) {
+#ifdef BYTECODE
+                // compile program and run the bytecode, if possible (and not switched off by COMPILE)
+                if (!(sys_config & cfg_text_only) && compile_program())
+                        return run_program();
+#endif
+        }
         line_ptr = program_space;
         return POST_CMD_EXEC_LINE;
 }
 
-int8_t prog_end (void)
+uint8_t compile (void)
+{
+        uint16_t value;
+        // non-zero: RUN compiles the program, 0: the text interpreter runs it
+        value = parse_expr();
+        if (error_code)
+                return POST_CMD_WARM_RESET;
+        if (value == 0)
+                sys_config |= cfg_text_only;
+        else
+                sys_config &= ~cfg_text_only;
+        return POST_CMD_NEXT_STATEMENT;
+}
+
+uint8_t prog_end (void)
 {
         // should be at end of line
         if (text_ptr[0] != LF) {
@@ -250,12 +309,12 @@ int8_t prog_end (void)
         return POST_CMD_EXEC_LINE;
 }
 
-int8_t prog_new (void)
+uint8_t prog_new (void)
 {
         if (text_ptr[0] != LF) {
                 error_code = 0x2;
                 return POST_CMD_WARM_RESET;
         }
-        prog_end_ptr = program_space;
+        clear_program();
         return POST_CMD_PROMPT;
 }
@@ -23,15 +23,19 @@
 #include "interpreter.h"
 #include "parser.h"
 
-int8_t prog_run (void);
-int8_t prog_end (void);
-int8_t prog_new (void);
-int8_t input (void);
-int8_t assignment (void);
-int8_t poke (void);
-int8_t list (void);
-int8_t mem (void);
-int8_t randomize (void);
-int8_t rndseed (void);
+uint8_t prog_run (void);
+uint8_t compile (void);
+uint8_t prog_end (void);
+uint8_t prog_new (void);
+uint8_t input (void);
+uint8_t assignment (void);
+uint8_t poke (void);
+uint8_t list (void);
+uint8_t mem (void);
+uint8_t randomize (void);
+uint8_t rndseed (void);
+uint8_t prog_delay (void);
+uint8_t remark (void);
+uint8_t not_implemented (void);
 
 #endif
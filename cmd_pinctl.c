@@ -23,7 +23,7 @@ uint8_t pindir (void)
 {
         uint16_t a, b;
         // get pin number [0..7]
-        a = parse_expr_s1();
+        a = parse_expr();
         if (error_code)
                 return POST_CMD_WARM_RESET;
         // check range
@@ -38,7 +38,7 @@ uint8_t pindir (void)
         }
         text_ptr++;
         // get direction [0/1]
-        b = parse_expr_s1();
+        b = parse_expr();
         if (error_code)
                 return POST_CMD_WARM_RESET;
         // create mask for altering direction
@@ -62,7 +62,7 @@ uint8_t pindwrite (void)
 {
         uint16_t a, b;
         // get pin number [0..7]
-        a = parse_expr_s1();
+        a = parse_expr();
         if (error_code)
                 return POST_CMD_WARM_RESET;
         // check range
@@ -77,7 +77,7 @@ uint8_t pindwrite (void)
         }
         text_ptr++;
         // get value [0/1]
-        b = parse_expr_s1();
+        b = parse_expr();
         if (error_code)
                 return POST_CMD_WARM_RESET;
         // create mask for altering direction
@@ -24,7 +24,7 @@ uint8_t reset_display (void)
         putchar (vid_reset);
         uart_ansi_rst_clr();
         printmsg (msg_welcome, stdout);
-        prog_end_ptr = program_space;
+        clear_program();
         return POST_CMD_PROMPT;
 }
 
@@ -39,7 +39,7 @@ uint8_t pen (void)
 {
         uint16_t col;
         // get color value
-        col = parse_expr_s1();
+        col = parse_expr();
         if (error_code)
                 return POST_CMD_WARM_RESET;
         if (col < 0 || col > 127) {
@@ -54,7 +54,7 @@ uint8_t paper (void)
 {
         uint16_t col;
         // get color value
-        col = parse_expr_s1();
+        col = parse_expr();
         if (error_code)
                 return POST_CMD_WARM_RESET;
         if (col < 0 || col > 127) {
@@ -69,7 +69,7 @@ uint8_t locate (void)
 {
         uint16_t line, column;
         // get target line
-        line = parse_expr_s1();
+        line = parse_expr();
         if (error_code)
                 return POST_CMD_WARM_RESET;
         if (line < 0 || line > 23) {
@@ -83,7 +83,7 @@ uint8_t locate (void)
         }
         text_ptr++;
         // get target line
-        column = parse_expr_s1();
+        column = parse_expr();
         if (error_code)
                 return POST_CMD_WARM_RESET;
         if (column < 0 || column > 31) {
@@ -114,7 +114,7 @@ uint8_t print (void)
                 } else {
                         uint16_t e;
                         error_code = 0;
-                        e = parse_expr_s1();
+                        e = parse_expr();
                         if (error_code) {
                                 return POST_CMD_WARM_RESET;
                         }
@@ -145,7 +145,7 @@ uint8_t pset (void)
 {
         uint16_t x, y, col;
         // get x-coordinate
-        x = parse_expr_s1();
+        x = parse_expr();
         if (error_code)
                 return POST_CMD_WARM_RESET;
         if (x < 0 || x > 255) {
@@ -159,7 +159,7 @@ uint8_t pset (void)
         }
         text_ptr++;
         // get y-coordinate
-        y = parse_expr_s1();
+        y = parse_expr();
         if (error_code)
                 return POST_CMD_WARM_RESET;
         if (y < 0 || y > 239) {
@@ -173,7 +173,7 @@ uint8_t pset (void)
         }
         text_ptr++;
         // get color
-        col = parse_expr_s1();
+        col = parse_expr();
         if (error_code)
                 return POST_CMD_WARM_RESET;
         if (col < 0 || col > 127) {
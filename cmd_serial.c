@@ -19,12 +19,58 @@
 
 #include "cmd_serial.h"
 
+static uint8_t xmodem_next (void);
+static uint8_t xmodem_block (void);
+static uint8_t xmodem_connect (void);
+static void xmodem_send (void);
+static void xmodem_purge (void);
+static void xmodem_cancel (void);
+static uint8_t xmodem_fill (uint8_t *data, uint16_t length);
+static int xmodem_putc (char chr, FILE *stream);
+static int xmodem_putline (char chr, FILE *stream);
+static uint8_t host_frame (uint8_t *dest, uint8_t *limit);
+static void host_record (uint8_t type);
+static void host_send (void);
+static void host_status (void);
+static void host_leave (void);
+static int host_putc (char chr, FILE *stream);
+static int host_getc (FILE *stream);
+static int host_record_putc (char chr, FILE *stream);
+
+/** The block being received or sent. */
+static uint8_t xm_block[XM_BLOCK_SIZE];
+/** The next byte of the block (@c XM_BLOCK_SIZE: none left to read). */
+static uint8_t xm_pos;
+/** The number of the block being sent (or expected). */
+static uint8_t xm_number;
+/** The state of the transfer (see XMODEM_STATES). */
+static uint8_t xm_state;
+static FILE stream_xmodem = FDEV_SETUP_STREAM (xmodem_putc, NULL, _FDEV_SETUP_WRITE);
+static FILE stream_listing = FDEV_SETUP_STREAM (xmodem_putline, NULL, _FDEV_SETUP_WRITE);
+
+/** The end of the text of the last frame received (where its CRC begins). */
+static uint8_t *hl_end;
+/** The value for INPUT (see host_getc()) and the next character of it (NULL: none left). */
+static uint8_t hl_value[HL_VALUE_SIZE];
+static uint8_t *hl_value_ptr;
+/** The outcome of the line being processed: error code and line number (see host_error()). */
+static uint8_t hl_code;
+static LINE_NUMBER hl_where;
+/** A record has begun, but has not been sent yet. */
+static uint8_t hl_open;
+static uint16_t hl_crc;
+/** The arguments of a GPU directive that are still to come (they are not text). */
+static uint8_t hl_skip;
+/** Standard input and output, while linked (see host()). */
+static FILE stream_host = FDEV_SETUP_STREAM (host_putc, host_getc, _FDEV_SETUP_RW);
+static FILE stream_record = FDEV_SETUP_STREAM (host_record_putc, NULL, _FDEV_SETUP_WRITE);
+
 uint8_t sload (void)
 {
         // get lines from SERIAL
         sys_config |= cfg_from_serial;
         // reset program space pointer
-        prog_end_ptr = program_space;
+        clear_program();
 
         return POST_CMD_WARM_RESET;
 }
@@ -34,10 +80,701 @@ uint8_t ssave (void)
         uint8_t *line = find_line();
         LINE_LENGTH length = 0;
         while (line != prog_end_ptr) {
-                printline (line, &stream_serial);
+                printline (line, NULL, &stream_serial);
                 length = (LINE_LENGTH) (*(line + sizeof (LINE_NUMBER)));
                 line += length;
         }
         fputc (0, &stream_serial);
+        // the listing is complete, when SSAVE returns
+        ser_flush();
+        return POST_CMD_NEXT_LINE;
+}
+
+uint8_t baud (void)
+{
+        uint16_t rate;
+        // get rate in hundreds of bps (0: default)
+        rate = parse_expr();
+        if (error_code)
+                return POST_CMD_WARM_RESET;
+        if (rate == 0) {
+                ser_baud_default();
+                return POST_CMD_NEXT_STATEMENT;
+        }
+        // check range (the clock cannot generate it)
+        if (rate > 10000 || !ser_baud (rate * 100UL)) {
+                error_code = 0x13;
+                return POST_CMD_WARM_RESET;
+        }
+        return POST_CMD_NEXT_STATEMENT;
+}
+
+uint8_t xsave (void)
+{
+        struct xmodem_image image;
+        uint8_t *line;
+        uint8_t *data;
+        uint8_t listing = 0;
+
+        // XSAVE LIST --> send the listing of the program
+        ignorespace();
+        if (*text_ptr == TOK_CMD + CMD_LIST) {
+                listing = 1;
+                text_ptr++;
+        }
+        xmodem_begin (1);
+        if (listing) {
+                for (line = program_space; line != prog_end_ptr; line += line[sizeof (LINE_NUMBER)])
+                        printline (line, NULL, &stream_listing);
+        } else {
+                // offsets of GOTO/GOSUB targets are not sent
+                unlink_program();
+                image.magic = EEPROM_MAGIC;
+                image.version = EEPROM_VERSION;
+                image.size = prog_end_ptr - program_space;
+                image.checksum = 0;
+                for (data = program_space; data != prog_end_ptr; data++)
+                        image.checksum = _crc_xmodem_update (image.checksum, *data);
+                for (data = (uint8_t *)&image; data != (uint8_t *)(&image + 1); data++)
+                        fputc (*data, &stream_xmodem);
+                for (data = program_space; data != prog_end_ptr; data++)
+                        fputc (*data, &stream_xmodem);
+        }
+        if (xmodem_end()) {
+                error_code = 0x1C;
+                return POST_CMD_WARM_RESET;
+        }
         return POST_CMD_NEXT_LINE;
 }
+
+uint8_t xload (void)
+{
+        struct xmodem_image image;
+        uint16_t crc = 0;
+        uint8_t *data;
+        uint8_t pad;
+        int16_t chr;
+
+        clear_program();
+        xmodem_begin (0);
+        // the first byte tells an image from a listing
+        chr = xmodem_peek();
+        if (chr >= 0 && chr != (EEPROM_MAGIC & 0xFF)) {
+                // listing --> read line by line, as if it was typed (see read_stream())
+                sys_config |= cfg_from_serial | cfg_from_xmodem;
+                return POST_CMD_WARM_RESET;
+        }
+        // program image (an empty transfer or a failed one ends here)
+        if (chr >= 0 && !xmodem_fill ((uint8_t *)&image, sizeof (struct xmodem_image))) {
+                if (image.magic != EEPROM_MAGIC || image.version != EEPROM_VERSION)
+                        error_code = 0x19;
+                else if (image.size > variables_ptr - program_space)
+                        error_code = 0x16;
+                else {
+                        // unpacked to the end of free memory (see load_slot())
+                        drop_index();
+                        tail_ptr = variables_ptr - image.size;
+                        if (!xmodem_fill (tail_ptr, image.size)) {
+                                for (data = tail_ptr; data != variables_ptr; data++)
+                                        crc = _crc_xmodem_update (crc, *data);
+                                if (crc != image.checksum)
+                                        error_code = 0x19;
+                                // the rest of the last block is padding
+                                while (error_code == 0 && xmodem_read (&pad, 1) != 0)
+                                        ;
+                        }
+                }
+        }
+        if (xmodem_end() && error_code == 0)
+                error_code = 0x1C;
+        if (error_code)
+                clear_program();
+        return POST_CMD_WARM_RESET;
+}
+
+uint8_t host (void)
+{
+        // the screen shows what happens, as usual; the host gets it as records
+        hl_code = 0;
+        hl_where = 0;
+        hl_open = 0;
+        hl_skip = 0;
+        hl_value_ptr = NULL;
+        stdout = stdin = &stream_host;
+        sys_config |= cfg_from_host;
+        return POST_CMD_WARM_RESET;
+}
+
+/** ***************************************************************************
+ * @brief Begin a transfer (see XSAVE, XLOAD).
+ *
+ * The serial port passes everything through (see ser_transparent()), until
+ * xmodem_end().
+ *
+ * @param send Non-zero to send, zero to receive.
+ *****************************************************************************/
+void xmodem_begin (uint8_t send)
+{
+        xm_state = send ? XM_CONNECT : XM_START;
+        xm_number = 1;
+        xm_pos = send ? 0 : XM_BLOCK_SIZE;
+        ser_transparent (1);
+}
+
+/** ***************************************************************************
+ * @brief Get the next byte received, without reading it.
+ *
+ * @return The byte, or -1 if the transfer has ended.
+ *****************************************************************************/
+int16_t xmodem_peek (void)
+{
+        if (xm_pos == XM_BLOCK_SIZE && !xmodem_next())
+                return -1;
+        return xm_block[xm_pos];
+}
+
+/** ***************************************************************************
+ * @brief Read the bytes received.
+ *
+ * Reading stops at the end of the block or after the end of a line (LF, CR,
+ * NULL or SUB), as in ser_read_block(). The block is acknowledged, when the
+ * next one is needed.
+ *
+ * @param dest Where to store the bytes.
+ * @param count The maximum number of bytes to read.
+ * @return The number of bytes read (0 if the transfer has ended).
+ *****************************************************************************/
+uint8_t xmodem_read (uint8_t *dest, uint8_t count)
+{
+        uint8_t done = 0;
+        uint8_t chr;
+
+        if (xm_pos == XM_BLOCK_SIZE && !xmodem_next())
+                return 0;
+        while (done < count && xm_pos < XM_BLOCK_SIZE) {
+                chr = xm_block[xm_pos];
+                xm_pos++;
+                dest[done++] = chr;
+                if (chr == LF || chr == CR || chr == 0 || chr == SUB)
+                        break;
+        }
+        return done;
+}
+
+/** ***************************************************************************
+ * @brief End the transfer.
+ *
+ * When sending, the last block is padded and sent, followed by EOT. When
+ * receiving, a transfer that has not ended yet is cancelled.
+ *
+ * @return Non-zero if the transfer has failed.
+ *****************************************************************************/
+uint8_t xmodem_end (void)
+{
+        uint8_t tries;
+        int16_t chr;
+
+        if (xm_state == XM_CONNECT || xm_state == XM_SEND) {
+                while (xm_pos != 0 && (xm_state == XM_CONNECT || xm_state == XM_SEND))
+                        xmodem_putc (SUB, &stream_xmodem);
+                // nothing was sent --> the receiver must have started, still
+                if (xm_state == XM_CONNECT && xmodem_connect())
+                        xm_state = XM_SEND;
+                for (tries = 0; tries < XM_RETRIES && xm_state == XM_SEND; tries++) {
+                        ser_put (XM_EOT);
+                        do
+                                chr = ser_receive (XM_REPLY_TIMEOUT);
+                        while (chr >= 0 && chr != XM_ACK && chr != XM_NAK && chr != XM_CAN);
+                        if (chr == XM_ACK)
+                                xm_state = XM_DONE;
+                        else if (chr == XM_CAN)
+                                break;
+                }
+        }
+        if (xm_state != XM_DONE && xm_state != XM_FAILED)
+                xmodem_cancel();
+        ser_flush();
+        ser_transparent (0);
+        tries = (xm_state != XM_DONE);
+        xm_state = XM_IDLE;
+        return tries;
+}
+
+/** ***************************************************************************
+ * @brief Acknowledge the block received and receive the next one.
+ *
+ * The first block is asked for with 'C', a damaged one with NAK.
+ *
+ * @return Non-zero if a block was received (zero at the end of the transfer
+ * or if it failed).
+ *****************************************************************************/
+static uint8_t xmodem_next (void)
+{
+        uint8_t tries, status;
+        uint8_t reply = (xm_state == XM_START) ? XM_CRC : XM_ACK;
+        int16_t chr;
+
+        if (xm_state != XM_START && xm_state != XM_RECEIVE)
+                return 0;
+        for (tries = 0; tries < XM_RETRIES; tries++) {
+                ser_put (reply);
+                chr = ser_receive ((xm_state == XM_START) ? XM_START_TIMEOUT : XM_REPLY_TIMEOUT);
+                if (chr == XM_SOH) {
+                        status = xmodem_block();
+                        if (status == XM_BLOCK_NEXT) {
+                                xm_state = XM_RECEIVE;
+                                xm_number++;
+                                xm_pos = 0;
+                                return 1;
+                        }
+                        // the sender has missed the ACK
+                        if (status == XM_BLOCK_AGAIN) {
+                                reply = XM_ACK;
+                                continue;
+                        }
+                        if (status == XM_BLOCK_LOST)
+                                break;
+                } else if (chr == XM_EOT) {
+                        ser_put (XM_ACK);
+                        xm_state = XM_DONE;
+                        return 0;
+                } else if (chr == XM_CAN || break_flow)
+                        break;
+                // nothing or a damaged block --> ask for it again
+                xmodem_purge();
+                if (xm_state == XM_RECEIVE)
+                        reply = XM_NAK;
+        }
+        xmodem_cancel();
+        return 0;
+}
+
+/** ***************************************************************************
+ * @brief Receive a block (its SOH has been received).
+ *
+ * @return What the block is (see XMODEM_BLOCKS).
+ *****************************************************************************/
+static uint8_t xmodem_block (void)
+{
+        uint8_t number, i;
+        uint16_t crc = 0;
+        int16_t chr;
+
+        // block number and its complement
+        chr = ser_receive (XM_TIMEOUT);
+        if (chr < 0)
+                return XM_BLOCK_BAD;
+        number = chr;
+        chr = ser_receive (XM_TIMEOUT);
+        if (chr < 0 || (uint8_t)(number + chr) != 0xFF)
+                return XM_BLOCK_BAD;
+        // the data and the CRC (high byte first): the CRC of both is zero
+        for (i = 0; i < XM_BLOCK_SIZE + 2; i++) {
+                chr = ser_receive (XM_TIMEOUT);
+                if (chr < 0)
+                        return XM_BLOCK_BAD;
+                if (i < XM_BLOCK_SIZE)
+                        xm_block[i] = chr;
+                crc = _crc_xmodem_update (crc, chr);
+        }
+        if (crc != 0)
+                return XM_BLOCK_BAD;
+        if (number == xm_number)
+                return XM_BLOCK_NEXT;
+        if (number == (uint8_t)(xm_number - 1) && xm_state == XM_RECEIVE)
+                return XM_BLOCK_AGAIN;
+        return XM_BLOCK_LOST;
+}
+
+/** ***************************************************************************
+ * @brief Wait for the receiver to ask for the first block (with CRC).
+ *
+ * @return Non-zero if it did.
+ *****************************************************************************/
+static uint8_t xmodem_connect (void)
+{
+        uint8_t seconds;
+        int16_t chr;
+
+        for (seconds = 0; seconds < XM_CONNECT_TIME && !break_flow; seconds++) {
+                chr = ser_receive (1000);
+                if (chr == XM_CRC)
+                        return 1;
+                if (chr == XM_CAN)
+                        break;
+        }
+        return 0;
+}
+
+/** ***************************************************************************
+ * @brief Send the block (it is full).
+ *****************************************************************************/
+static void xmodem_send (void)
+{
+        uint8_t tries, i;
+        uint16_t crc = 0;
+        int16_t chr;
+
+        if (xm_state == XM_CONNECT) {
+                if (!xmodem_connect()) {
+                        xmodem_cancel();
+                        return;
+                }
+                xm_state = XM_SEND;
+        }
+        for (i = 0; i < XM_BLOCK_SIZE; i++)
+                crc = _crc_xmodem_update (crc, xm_block[i]);
+        for (tries = 0; tries < XM_RETRIES; tries++) {
+                ser_put (XM_SOH);
+                ser_put (xm_number);
+                ser_put (~xm_number);
+                for (i = 0; i < XM_BLOCK_SIZE; i++)
+                        ser_put (xm_block[i]);
+                ser_put (crc >> 8);
+                ser_put (crc & 0xFF);
+                // anything else (another 'C', for example) is ignored
+                do
+                        chr = ser_receive (XM_REPLY_TIMEOUT);
+                while (chr >= 0 && chr != XM_ACK && chr != XM_NAK && chr != XM_CAN);
+                if (chr == XM_ACK) {
+                        xm_number++;
+                        xm_pos = 0;
+                        return;
+                }
+                if (chr == XM_CAN || break_flow)
+                        break;
+        }
+        xmodem_cancel();
+}
+
+/** ***************************************************************************
+ * @brief Drop whatever arrives, until the line is quiet.
+ *****************************************************************************/
+static void xmodem_purge (void)
+{
+        while (ser_receive (XM_TIMEOUT) >= 0)
+                ;
+}
+
+/** ***************************************************************************
+ * @brief Cancel the transfer.
+ *****************************************************************************/
+static void xmodem_cancel (void)
+{
+        ser_put (XM_CAN);
+        ser_put (XM_CAN);
+        xm_state = XM_FAILED;
+}
+
+/** ***************************************************************************
+ * @brief Read bytes received, as they are.
+ *
+ * @return Non-zero if the transfer has ended first.
+ *****************************************************************************/
+static uint8_t xmodem_fill (uint8_t *data, uint16_t length)
+{
+        uint8_t count;
+
+        while (length > 0) {
+                count = xmodem_read (data, (length > XM_BLOCK_SIZE) ? XM_BLOCK_SIZE : length);
+                if (count == 0)
+                        return 1;
+                data += count;
+                length -= count;
+        }
+        return 0;
+}
+
+/** ***************************************************************************
+ * @brief Add a byte to the block being sent (see stream_xmodem).
+ *
+ * Once the transfer has failed, bytes are dropped.
+ *****************************************************************************/
+static int xmodem_putc (char chr, FILE *stream)
+{
+        if (xm_state != XM_CONNECT && xm_state != XM_SEND)
+                return 0;
+        xm_block[xm_pos] = chr;
+        xm_pos++;
+        if (xm_pos == XM_BLOCK_SIZE)
+                xmodem_send();
+        return 0;
+}
+
+/** ***************************************************************************
+ * @brief Add a character of the listing to the block being sent.
+ *
+ * Lines end with LF only (see newline()).
+ *****************************************************************************/
+static int xmodem_putline (char chr, FILE *stream)
+{
+        if (chr != CR)
+                xmodem_putc (chr, stream);
+        return 0;
+}
+
+/** ***************************************************************************
+ * @brief Get the next line from the host.
+ *
+ * First, the outcome of the previous line goes to the host (a status record,
+ * which takes the place of the prompt). Then frames are received, until a
+ * line arrives: it is left at @c text_ptr, ending with LF, as get_line()
+ * would leave a line typed on the keyboard. A damaged frame, or one that is
+ * not expected, is refused. A line that does not fit is an error, as when
+ * loading.
+ *
+ * The link ends when the host asks for it or BREAK is pressed: an empty line
+ * is left and get_line() reads the keyboard from then on. While waiting,
+ * CTRL+C from the host does not break (see ser_transparent()), so that a late
+ * one, meant for a program that has ended already, does not end the link.
+ *****************************************************************************/
+void host_line (void)
+{
+        uint8_t *limit = text_ptr + MAX_LINE_LENGTH + HL_CRC_SIZE;
+        uint8_t type;
+
+        // leave room for LF
+        if (limit > tail_ptr - 1)
+                limit = tail_ptr - 1;
+        host_status();
+        break_flow = 0;
+        EIMSK |= BREAK_INT;
+        ser_transparent (1);
+        while (1) {
+                type = host_frame (text_ptr, limit);
+                if (type == HL_LINE) {
+                        text_ptr = hl_end;
+                        break;
+                }
+                if (type == HL_FRAME_LONG) {
+                        error_code = (limit == tail_ptr - 1) ? 0x16 : 0x17;
+                        break;
+                }
+                if (type == HL_QUIT || type == HL_FRAME_BREAK) {
+                        if (type == HL_QUIT)
+                                host_status();
+                        host_leave();
+                        break;
+                }
+                host_record (HL_REFUSED);
+                host_send();
+        }
+        ser_transparent (0);
+        text_ptr[0] = LF;
+}
+
+/** ***************************************************************************
+ * @brief Keep the outcome of the line being processed (see error_message()).
+ *****************************************************************************/
+void host_error (void)
+{
+        hl_code = error_code;
+        hl_where = (line_ptr != NULL) ? *((LINE_NUMBER *)line_ptr) : 0;
+}
+
+/** ***************************************************************************
+ * @brief Receive a frame from the host.
+ *
+ * Anything before @c HL_START is dropped. The text of the frame and its CRC
+ * are stored; @c hl_end points to the end of the text.
+ *
+ * @param dest Where to store the text of the frame.
+ * @param limit The end of the room available.
+ * @return The type of the frame or what arrived instead (see HOST_FRAMES).
+ *****************************************************************************/
+static uint8_t host_frame (uint8_t *dest, uint8_t *limit)
+{
+        uint8_t *end = dest;
+        uint8_t type, i;
+        uint16_t crc, sum = 0;
+        int16_t chr;
+
+        do {
+                if (break_flow)
+                        return HL_FRAME_BREAK;
+                chr = ser_receive (100);
+        } while (chr != HL_START);
+        chr = ser_receive (HL_TIMEOUT);
+        if (chr < 0 || chr == LF || chr == CR)
+                return HL_FRAME_DAMAGED;
+        type = chr;
+        crc = _crc_xmodem_update (0, type);
+        while (1) {
+                chr = ser_receive (HL_TIMEOUT);
+                if (chr < 0)
+                        return HL_FRAME_DAMAGED;
+                if (chr == LF || chr == CR)
+                        break;
+                // too long --> the rest of the line is dropped
+                if (end == limit) {
+                        while (chr >= 0 && chr != LF && chr != CR)
+                                chr = ser_receive (HL_TIMEOUT);
+                        return HL_FRAME_LONG;
+                }
+                *end++ = chr;
+        }
+        if (end - dest < HL_CRC_SIZE)
+                return HL_FRAME_DAMAGED;
+        hl_end = end - HL_CRC_SIZE;
+        for (end = dest; end != hl_end; end++)
+                crc = _crc_xmodem_update (crc, *end);
+        // hex digits, upper or lower case
+        for (i = 0; i < HL_CRC_SIZE; i++) {
+                chr = hl_end[i] | 0x20;
+                if (chr >= '0' && chr <= '9')
+                        chr -= '0';
+                else if (chr >= 'a' && chr <= 'f')
+                        chr -= 'a' - 10;
+                else
+                        return HL_FRAME_DAMAGED;
+                sum = sum << 4 | chr;
+        }
+        if (sum != crc)
+                return HL_FRAME_DAMAGED;
+        return type;
+}
+
+/** ***************************************************************************
+ * @brief Begin a record for the host.
+ *
+ * A line of output that has not ended yet is sent first, as it is.
+ *****************************************************************************/
+static void host_record (uint8_t type)
+{
+        if (hl_open)
+                host_send();
+        ser_put (HL_START);
+        hl_crc = 0;
+        hl_open = 1;
+        host_record_putc (type, &stream_record);
+}
+
+/** ***************************************************************************
+ * @brief Send the CRC of the record and the end of the line.
+ *****************************************************************************/
+static void host_send (void)
+{
+        uint8_t i, digit;
+
+        for (i = 0; i < HL_CRC_SIZE; i++) {
+                digit = hl_crc >> 12;
+                ser_put ((digit < 10) ? '0' + digit : 'A' - 10 + digit);
+                hl_crc <<= 4;
+        }
+        ser_put (CR);
+        ser_put (LF);
+        hl_open = 0;
+}
+
+/** ***************************************************************************
+ * @brief Send the outcome of the line processed: the error code (hex, 00 if
+ * none) and the line where the error occurred (in a program).
+ *****************************************************************************/
+static void host_status (void)
+{
+        host_record (HL_STATUS);
+        fprintf (&stream_record, "%02X", hl_code);
+        if (hl_where != 0) {
+                fputc (SPACE, &stream_record);
+                printnum (hl_where, &stream_record);
+        }
+        host_send();
+        hl_code = 0;
+        hl_where = 0;
+}
+
+/** ***************************************************************************
+ * @brief End the link: the keyboard and the screen are the console again.
+ *****************************************************************************/
+static void host_leave (void)
+{
+        if (hl_open)
+                host_send();
+        stdout = stdin = &stream_physical;
+        sys_config &= ~cfg_from_host;
+        break_flow = 0;
+        // the prompt was left out while linked (see warm_reset())
+        printmsg (msg_ok, stdout);
+}
+
+/** ***************************************************************************
+ * @brief Print a character (see stream_host).
+ *
+ * The character goes to the screen. Text also goes to the host, one record
+ * per line; the GPU directives and their arguments do not.
+ *****************************************************************************/
+static int host_putc (char chr, FILE *stream)
+{
+        putchar_phy (chr, stream);
+        if (hl_skip != 0) {
+                hl_skip--;
+                return 0;
+        }
+        switch ((uint8_t)chr) {
+                case vid_color:
+                case vid_paper:
+                        hl_skip = 1;
+                        break;
+                case vid_locate:
+                        hl_skip = 2;
+                        break;
+                case vid_pixel:
+                        hl_skip = 3;
+                        break;
+                case LF:
+                        if (!hl_open)
+                                host_record (HL_OUTPUT);
+                        host_send();
+                        break;
+                default:
+                        if (chr >= SPACE && chr < 0x7F) {
+                                if (!hl_open)
+                                        host_record (HL_OUTPUT);
+                                host_record_putc (chr, &stream_record);
+                        }
+        }
+        return 0;
+}
+
+/** ***************************************************************************
+ * @brief Get a character of the value for INPUT (see stream_host).
+ *
+ * When a value has been read (up to its LF), the next one is asked for with a
+ * request record. Frames other than a value are refused. BREAK (or CTRL+C
+ * from the host) ends the wait with an empty value.
+ *****************************************************************************/
+static int host_getc (FILE *stream)
+{
+        uint8_t type;
+        uint8_t chr;
+
+        if (hl_value_ptr == NULL) {
+                host_record (HL_INPUT);
+                host_send();
+                while (1) {
+                        type = host_frame (hl_value, hl_value + HL_VALUE_SIZE - 1);
+                        if (type == HL_FRAME_BREAK)
+                                return LF;
+                        if (type == HL_VALUE)
+                                break;
+                        host_record (HL_REFUSED);
+                        host_send();
+                }
+                hl_end[0] = LF;
+                hl_value_ptr = hl_value;
+        }
+        chr = *hl_value_ptr++;
+        if (chr == LF)
+                hl_value_ptr = NULL;
+        return chr;
+}
+
+/** ***************************************************************************
+ * @brief Add a character to the record being sent (see stream_record).
+ *****************************************************************************/
+static int host_record_putc (char chr, FILE *stream)
+{
+        ser_put (chr);
+        hl_crc = _crc_xmodem_update (hl_crc, chr);
+        return 0;
+}
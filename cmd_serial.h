@@ -25,5 +25,94 @@
 
 uint8_t sload (void);
 uint8_t ssave (void);
+uint8_t baud (void);
+uint8_t xsave (void);
+uint8_t xload (void);
+void xmodem_begin (uint8_t send);
+int16_t xmodem_peek (void);
+uint8_t xmodem_read (uint8_t *dest, uint8_t count);
+uint8_t xmodem_end (void);
+uint8_t host (void);
+void host_line (void);
+void host_error (void);
+
+/**
+ * XSAVE and XLOAD transfer programs with XMODEM: blocks of @c XM_BLOCK_SIZE
+ * bytes, numbered from 1, each one followed by its CRC-16 (the receiver asks
+ * for CRC by sending 'C' to start). Every block is acknowledged (ACK) or sent
+ * again (NAK). EOT ends the transfer and CAN cancels it. The last block is
+ * padded with SUB.
+ *
+ * A program is sent either as a listing (text) or as an image of program
+ * memory, which begins with a @c xmodem_image header.
+ */
+#define XM_SOH          0x01
+#define XM_EOT          0x04
+#define XM_ACK          0x06
+#define XM_NAK          0x15
+#define XM_CAN          0x18
+#define XM_CRC          'C'
+#define XM_BLOCK_SIZE   128
+/** How many times a block is sent (or asked for), before giving up. */
+#define XM_RETRIES      10
+/** How long to wait (ms): for the first block, for a reply or the next block, within a block. */
+#define XM_START_TIMEOUT 3000
+#define XM_REPLY_TIMEOUT 10000
+#define XM_TIMEOUT      1000
+/** How long XSAVE waits for the receiver to start (seconds). */
+#define XM_CONNECT_TIME 60
+
+/** The header of a program image (the program follows, as it is in memory). */
+struct xmodem_image {
+        uint16_t magic;                 // EEPROM_MAGIC (a listing begins with a digit)
+        uint8_t version;                // EEPROM_VERSION
+        uint16_t size;                  // bytes of program
+        uint16_t checksum;              // CRC-16 of the program
+};
+
+/**
+ * HOST links nstBASIC to a computer over the serial port. Both sides send
+ * frames, one per line: @c HL_START, the type of the frame, its text and the
+ * CRC-16 of the type and the text (@c HL_CRC_SIZE hex digits, high first).
+ * The host sends lines, as if typed, and gets back the output, requests for
+ * INPUT and the outcome of every line (see host_line()).
+ */
+#define HL_START        ':'
+#define HL_LINE         'L'             // host: a program line or a command
+#define HL_VALUE        'V'             // host: the value INPUT waits for
+#define HL_QUIT         'Q'             // host: end the link
+#define HL_OUTPUT       'O'             // nstBASIC: a line of output
+#define HL_INPUT        'I'             // nstBASIC: INPUT waits for a value
+#define HL_STATUS       'S'             // nstBASIC: the line is done (error code, line number)
+#define HL_REFUSED      'N'             // nstBASIC: the frame was damaged or not expected
+#define HL_CRC_SIZE     4
+/** The longest value frame (digits, CRC and LF). */
+#define HL_VALUE_SIZE   (INPUT_BUFFER_SIZE + HL_CRC_SIZE + 1)
+/** How long to wait for the rest of a frame (ms). */
+#define HL_TIMEOUT      1000
+
+enum XMODEM_STATES {
+        XM_IDLE = 0,
+        XM_START,                       // receiving, no block yet
+        XM_RECEIVE,
+        XM_CONNECT,                     // sending, the receiver has not started yet
+        XM_SEND,
+        XM_DONE,
+        XM_FAILED
+};
+
+enum XMODEM_BLOCKS {
+        XM_BLOCK_NEXT = 0,              // the expected block
+        XM_BLOCK_AGAIN,                 // the previous block (its ACK was lost)
+        XM_BLOCK_BAD,                   // damaged or incomplete
+        XM_BLOCK_LOST                   // out of sequence
+};
+
+/** What is received instead of a frame (see host_frame()). */
+enum HOST_FRAMES {
+        HL_FRAME_BREAK = 0,             // BREAK, while waiting
+        HL_FRAME_DAMAGED,               // incomplete or wrong CRC
+        HL_FRAME_LONG                   // does not fit
+};
 
 #endif
@@ -25,7 +25,8 @@
  * and/or programs. Every line entered by the user, that starts with a valid line-number,
  * is considered part of the currently active program and is stored at the appropriate
  * position in program memory. If the newly entered line does not start with a line-number,
- * it is executed immediately.
+ * it is executed immediately. In both cases, keywords are replaced with single-byte tokens
+ * (see tokenize()), so that no keyword is ever searched for during execution.
  * @note Although the functions in this file perform some kind of parsing (syntactic analysis),
  * they are kept separately from the main parser functions. The interpreter functions determine
  * the state of the whole system, they run programs and call other functions, that execute single
@@ -38,18 +39,22 @@
 
 static uint8_t execution (void);
 static void warm_reset (void);
-static void insert_line (LINE_LENGTH chars_to_copy);
-static void remove_line (void);
-static void move_line (void);
-static LINE_LENGTH prep_line (void);
+static void merge_line (LINE_LENGTH length);
+static void close_gap (uint16_t carry);
+static void move_gap (int16_t distance, uint16_t carry);
+static void move_bytes (uint8_t *dest, uint8_t *source, uint16_t count);
+static void move_line (uint8_t *line, uint16_t length);
+static LINE_LENGTH prep_line (LINE_LENGTH length);
 static void error_message (void);
 
-static uint8_t *start;
+/** The number of the last line before the gap (0 if there is none). */
+static LINE_NUMBER gap_line;
 
 /** ***************************************************************************
  * @brief Get current line number.
  *
- * This function scans current line and looks for a valid line number.
+ * This function scans current line and looks for a valid line number. The
+ * number may also be stored in binary form (see tokenize()).
  * @note Scanning of current line begins at the character pointed by @c text_ptr.
  * @return The current line number.
  *****************************************************************************/
@@ -57,6 +62,11 @@ uint16_t get_line_numberber (void)
 {
         uint16_t num = 0;
         ignorespace();
+        if (*text_ptr == TOK_NUM) {
+                num = *((uint16_t *)(text_ptr + 1));
+                text_ptr += 3;
+                return num;
+        }
         while (*text_ptr >= '0' && *text_ptr <= '9') {
                 // check for overflow...
                 if (num >= 0xFFFF / 10) {
@@ -77,10 +87,14 @@ uint16_t get_line_numberber (void)
  *****************************************************************************/
 void basic_init (void)
 {
-        prog_end_ptr = program_space;
-        stack_ptr = program_space + MEMORY_SIZE;
+        reset_stack();
         stack_limit = program_space + MEMORY_SIZE - STACK_SIZE;
         variables_ptr = stack_limit - 27 * VAR_SIZE;
+        clear_program();
+
+        // resuming a snapshot --> as quietly as possible (see main())
+        if (sys_config & cfg_auto_run)
+                return;
 
         // print (available) SRAM size
         printnum (variables_ptr - prog_end_ptr, stdout);
@@ -92,6 +106,163 @@ void basic_init (void)
         newline (stdout);
 }
 
+/** ***************************************************************************
+ * @brief Erase the program in memory.
+ *
+ * This function empties program memory along with the line index.
+ *****************************************************************************/
+void clear_program (void)
+{
+        // free memory might hold an image that is being saved (see save_slot())
+        rom_wait();
+        prog_end_ptr = program_space;
+        line_index = (struct line_index_entry *)variables_ptr;
+        tail_ptr = variables_ptr;
+        gap_line = 0;
+        index_valid = 1;
+        program_linked = 0;
+        // a new program has no name (see load_slot())
+        program_name[0] = 0;
+}
+
+/** ***************************************************************************
+ * @brief Build the line index.
+ *
+ * This function walks the whole program and creates a sorted table with the
+ * number and the position of every line, so that find_line() can use binary
+ * search. The table is placed at the end of free memory. If there is not
+ * enough room, the index is dropped and find_line() falls back to walking
+ * the program line by line.
+ *
+ * @note The gap of program memory should be closed (see close_gap()).
+ *****************************************************************************/
+void build_index (void)
+{
+        uint8_t *line;
+        uint16_t count = 0;
+        struct line_index_entry *entry;
+
+        // count program lines
+        for (line = program_space; line != prog_end_ptr; line += line[sizeof (LINE_NUMBER)])
+                count++;
+
+        // check for available memory
+        if (prog_end_ptr + count * sizeof (struct line_index_entry) > variables_ptr) {
+                drop_index();
+                return;
+        }
+
+        // fill the index
+        line_index = (struct line_index_entry *)variables_ptr - count;
+        tail_ptr = (uint8_t *)line_index;
+        entry = line_index;
+        for (line = program_space; line != prog_end_ptr; line += line[sizeof (LINE_NUMBER)]) {
+                entry->line_number = *((LINE_NUMBER *)line);
+                entry->offset = line - program_space;
+                entry++;
+        }
+        index_valid = 1;
+}
+
+/** ***************************************************************************
+ * @brief Drop the line index.
+ *
+ * This function releases the memory occupied by the line index.
+ *****************************************************************************/
+void drop_index (void)
+{
+        // no lines after the gap --> the gap takes the released memory as well
+        if (tail_ptr == (uint8_t *)line_index)
+                tail_ptr = variables_ptr;
+        line_index = (struct line_index_entry *)variables_ptr;
+        index_valid = 0;
+}
+
+/** ***************************************************************************
+ * @brief Resolve constant GOTO/GOSUB targets.
+ *
+ * This function is called before a program runs. It finds every GOTO and
+ * GOSUB statement whose target is a plain number and replaces @c TOK_NUM with
+ * @c TOK_LINK followed by the offset of the target line. The statements then
+ * jump without evaluating an expression or searching for the line. Targets
+ * that are computed or do not exist are left as they are.
+ *****************************************************************************/
+void link_program (void)
+{
+        uint8_t *line, *token, *target;
+
+        // the gap and the index take free memory, which might be being saved (see save_slot())
+        if (tail_ptr != (uint8_t *)line_index || !index_valid)
+                rom_wait();
+        close_gap (0);
+        if (!index_valid)
+                build_index();
+        if (program_linked)
+                return;
+
+        for (line = program_space; line != prog_end_ptr; line += line[sizeof (LINE_NUMBER)]) {
+                token = line + sizeof (LINE_NUMBER) + sizeof (LINE_LENGTH);
+                while (*token != LF) {
+                        // skip numbers (their value might look like a token)
+                        if (*token == TOK_NUM) {
+                                token += 3;
+                                continue;
+                        }
+                        if (*token != TOK_CMD + CMD_GOTO && *token != TOK_CMD + CMD_GOSUB) {
+                                token++;
+                                continue;
+                        }
+                        // the target should be a number and nothing else
+                        token++;
+                        while (*token == ' ')
+                                token++;
+                        if (*token != TOK_NUM)
+                                continue;
+                        text_ptr = token + 3;
+                        ignorespace();
+                        if (*text_ptr != LF)
+                                continue;
+                        line_number = *((LINE_NUMBER *)(token + 1));
+                        target = find_line();
+                        if (target != prog_end_ptr && *((LINE_NUMBER *)target) == line_number) {
+                                token[0] = TOK_LINK;
+                                *((uint16_t *)(token + 1)) = target - program_space;
+                        }
+                        token += 3;
+                }
+        }
+        program_linked = 1;
+}
+
+/** ***************************************************************************
+ * @brief Restore constant GOTO/GOSUB targets.
+ *
+ * This function undoes link_program(). It is called before the program is
+ * modified, since the stored offsets would no longer be valid.
+ *****************************************************************************/
+void unlink_program (void)
+{
+        uint8_t *line, *token;
+
+        if (!program_linked)
+                return;
+
+        for (line = program_space; line != prog_end_ptr; line += line[sizeof (LINE_NUMBER)]) {
+                token = line + sizeof (LINE_NUMBER) + sizeof (LINE_LENGTH);
+                while (*token != LF) {
+                        if (*token == TOK_LINK) {
+                                token[0] = TOK_NUM;
+                                *((LINE_NUMBER *)(token + 1)) = *((LINE_NUMBER *)(program_space + *((uint16_t *)(token + 1))));
+                        }
+                        if (*token == TOK_NUM)
+                                token += 3;
+                        else
+                                token++;
+                }
+        }
+        program_linked = 0;
+}
+
 /** ***************************************************************************
  * @brief The interpreter main loop.
  *
@@ -105,8 +276,8 @@ void interpreter (void)
         uint8_t exec_status;
         LINE_LENGTH line_length;
 
-        /* start interpreter with a warm-reset */
-        exec_status = POST_CMD_WARM_RESET;
+        /* start interpreter with a warm-reset (unless resuming a snapshot, see main()) */
+        exec_status = (sys_config & cfg_auto_run) ? POST_CMD_NOTHING : POST_CMD_WARM_RESET;
 
         while(1) {
                 /* if have to --> perform warm-reset */
@@ -117,52 +288,76 @@ void interpreter (void)
 
                 while(1) {
                         error_code = 0;
-                        /* check if autorun is enabled */
-                        if ((sys_config & cfg_auto_run) || (sys_config & cfg_run_after_load)) {
-                                sys_config &= ~cfg_auto_run;
+                        /* check if autorun is enabled (once a listing has been loaded) */
+                        if (((sys_config & cfg_auto_run) || (sys_config & cfg_run_after_load)) &&
+                            !(sys_config & (cfg_from_eeprom | cfg_from_serial))) {
+                                /* snapshot found --> continue where it stopped */
+                                if (sys_config & cfg_auto_run) {
+                                        sys_config &= ~cfg_auto_run;
+                                        sys_config &= ~cfg_run_after_load;
+                                        if (resume())
+                                                break;
+                                        /* nothing to run (or some error) */
+                                        if (error_code)
+                                                error_message();
+                                        warm_reset();
+                                        continue;
+                                }
                                 sys_config &= ~cfg_run_after_load;
+                                link_program();
+                                overlay_begin();
                                 line_ptr = program_space;
                                 text_ptr = line_ptr + sizeof (LINE_NUMBER) + sizeof (LINE_LENGTH);
                                 break;
                         }
 
                         get_line();
+                        /* line too long or out of memory (while loading) */
+                        if (error_code)
+                                break;
                         uppercase();
-                        move_line();
+                        /* move line out of the way, to the end of free memory (unless already read past the program) */
+                        if (input_ptr == prog_end_ptr + sizeof (uint16_t)) {
+                                /* ...where an image might be being saved still (see save_slot()) */
+                                rom_wait();
+                                move_line (input_ptr, text_ptr - input_ptr + 1);
+                        } else
+                                text_ptr = input_ptr;
 
                         /* attempt to read line number */
                         line_number = get_line_numberber();
                         ignorespace();
 
+                        /* invalid number --> ignore line & warm reset */
+                        if (line_number == 0xFFFF) {
+                                error_code = 0x9;
+                                break;
+                        }
+
+                        /* replace keywords with tokens */
+                        line_length = tokenize (prog_end_ptr + sizeof (LINE_NUMBER) + sizeof (LINE_LENGTH));
+                        if (error_code)
+                                break;
+
                         /* chech if line number was found */
                         if (line_number != 0) {
-                                /* invalid number --> ignore line & warm reset */
-                                if (line_number == 0xFFFF) {
-                                        error_code = 0x9;
+                                /* line offsets are about to change */
+                                unlink_program();
+                                /* embed line number and line length */
+                                line_length = prep_line (line_length);
+                                /* valid number --> merge with program (empty line --> delete) */
+                                merge_line (line_length);
+                                if (error_code)
                                         break;
-                                }
-                                /* valid number --> merge with program */
-                                else {
-                                        /* embed line number and line length */
-                                        line_length = prep_line();
-                                        /* remove line with same line number */
-                                        start = find_line();
-                                        remove_line();
-                                        /* new line is empty --> get another one */
-                                        if (text_ptr[sizeof (LINE_NUMBER) + sizeof (LINE_LENGTH)] == LF)
-                                        continue;
-                                        /* append new line to program */
-                                        insert_line(line_length);
-                                }
                         }
                         /* no line number --> execute it immediately */
                         else {
                                 break_flow = 0;
-                                text_ptr = prog_end_ptr + sizeof (uint16_t);
                                 if (*text_ptr == LF)
                                         continue;
-                                else
-                                        break;
+                                /* the program should be contiguous, while executing */
+                                close_gap (line_length + sizeof (LINE_NUMBER) + sizeof (LINE_LENGTH));
+                                break;
                         }
                 }
 
@@ -179,13 +374,74 @@ void interpreter (void)
         }
 }
 
+/** The handler and the flags of every command, indexed by command number. */
+const struct command_entry command_table[CMD_UNKNOWN + 1] PROGMEM = {
+        [CMD_LIST]      = { list,               CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_NEW]       = { prog_new,           CMD_FLAG_DIRECT },
+        [CMD_RUN]       = { prog_run,           CMD_FLAG_DIRECT },
+        [CMD_NEXT]      = { next,               CMD_FLAG_DIRECT | CMD_FLAG_CHAIN },
+        [CMD_LET]       = { assignment,         CMD_FLAG_DIRECT | CMD_FLAG_CHAIN },
+        [CMD_IF]        = { check,              CMD_FLAG_DIRECT },
+        [CMD_GOTO]      = { gotoline,           CMD_FLAG_DIRECT },
+        [CMD_MPLAY]     = { play,               CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_MSTOP]     = { stop,               CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_TEMPO]     = { tempo,              CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_MUSIC]     = { music,              CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_GOSUB]     = { gosub,              CMD_FLAG_DIRECT },
+        [CMD_RETURN]    = { subreturn,          CMD_FLAG_CHAIN },
+        [CMD_RANDOMIZE] = { randomize,          CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_RNDSEED]   = { rndseed,            CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_RST]       = { reset_display,      CMD_FLAG_DIRECT },
+        [CMD_CLS]       = { clear_screen,       CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_REM]       = { remark,             CMD_FLAG_DIRECT },
+        [CMD_FOR]       = { loopfor,            CMD_FLAG_DIRECT | CMD_FLAG_CHAIN },
+        [CMD_INPUT]     = { input,              CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_BEEP]      = { beep,               CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_PRINT]     = { print,              CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_LOCATE]    = { locate,             CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_POKE]      = { poke,               CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_PSET]      = { pset,               CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_STOP]      = { prog_end,           CMD_FLAG_DIRECT },
+        [CMD_END]       = { prog_end,           CMD_FLAG_DIRECT },
+        [CMD_MEM]       = { mem,                CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_PEN]       = { pen,                CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_PAPER]     = { paper,              CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_QMARK]     = { print,              CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_HASH]      = { remark,             CMD_FLAG_DIRECT },
+        [CMD_QUOTE]     = { remark,             CMD_FLAG_DIRECT },
+        [CMD_DELAY]     = { prog_delay,         CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_ELIST]     = { elist,              CMD_FLAG_DIRECT },
+        [CMD_EFORMAT]   = { eformat,            CMD_FLAG_DIRECT },
+        [CMD_ECHAIN]    = { echain,             CMD_FLAG_DIRECT },
+        [CMD_ESAVE]     = { esave,              CMD_FLAG_DIRECT },
+        [CMD_ELOAD]     = { eload,              CMD_FLAG_DIRECT },
+        [CMD_SSAVE]     = { ssave,              CMD_FLAG_DIRECT },
+        [CMD_SLOAD]     = { sload,              CMD_FLAG_DIRECT },
+        [CMD_FILES]     = { files,              CMD_FLAG_DIRECT },
+        [CMD_CFORMAT]   = { cformat,            CMD_FLAG_DIRECT },
+        [CMD_CCHAIN]    = { cchain,             CMD_FLAG_DIRECT },
+        [CMD_CSAVE]     = { csave,              CMD_FLAG_DIRECT },
+        [CMD_CLOAD]     = { cload,              CMD_FLAG_DIRECT },
+        [CMD_PINDIR]    = { pindir,             CMD_FLAG_DIRECT | CMD_FLAG_SIMPLE },
+        [CMD_PINDWRITE] = { pindwrite,          CMD_FLAG_DIRECT | CMD_FLAG_SIMPLE },
+        [CMD_SNAPSHOT]  = { snapshot,           CMD_FLAG_DIRECT | CMD_FLAG_CHAIN },
+        [CMD_BAUD]      = { baud,               CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_XSAVE]     = { xsave,              CMD_FLAG_DIRECT },
+        [CMD_XLOAD]     = { xload,              CMD_FLAG_DIRECT },
+        [CMD_HOST]      = { host,               CMD_FLAG_DIRECT },
+        [CMD_ESYNC]     = { esync,              CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_COMPILE]   = { compile,            CMD_FLAG_DIRECT | CMD_FLAG_CHAIN | CMD_FLAG_SIMPLE },
+        [CMD_UNKNOWN]   = { assignment,         CMD_FLAG_DIRECT | CMD_FLAG_CHAIN }
+};
+
 /** ***************************************************************************
  * @brief Execute specified line.
  *
- * This function executes the current line. A helper function (scantable())
- * looks for the presence of any command and the huge switch block executes
- * the said command. When a program is running, this function loops over
- * and keeps executing one line after the other.
+ * This function executes the current line. Every statement begins with the
+ * token of some command (see tokenize()), which is used as an index in
+ * @c command_table to find the function that executes the said command.
+ * When a program is running, this function loops over and keeps executing
+ * one line after the other.
  *
  * @note The current line begins at the character pointed by @c text_ptr.
  * When running a program, @c text_ptr is advanced automatically.
@@ -196,9 +452,10 @@ void interpreter (void)
  *****************************************************************************/
 static uint8_t execution (void)
 {
-        uint16_t value;
         uint8_t index;
+        uint8_t flags;
         uint8_t cmd_status;
+        uint8_t (*handler) (void);
 
         while(1) {
                 if (break_test()) {
@@ -206,148 +463,19 @@ static uint8_t execution (void)
                         return POST_CMD_WARM_RESET;
                 }
 
-                cmd_status = POST_CMD_NOTHING;
                 error_code = 0;
-                index = scantable (commands);
+                index = scantoken (TOK_CMD, CMD_UNKNOWN);
+                handler = pgm_read_ptr (&command_table[index].handler);
+                flags = pgm_read_byte (&command_table[index].flags);
 
-                switch (index) {
-                        case CMD_DELAY:
-                                value = parse_expr_s1();
-                                fx_delay_ms (value);
-                                cmd_status = POST_CMD_NEXT_LINE;
-                                break;
-                        case CMD_NEW:
-                                cmd_status = prog_new();
-                                break;
-                        case CMD_BEEP:
-                                do_beep();
-                                cmd_status = POST_CMD_NEXT_LINE;
-                                break;
-                        case CMD_RUN:
-                                cmd_status = prog_run();
-                                break;
-                        case CMD_IF:
-                                cmd_status = check();
-                                break;
-                        case CMD_GOTO:
-                                cmd_status = gotoline();
-                                break;
-                        case CMD_MPLAY:
-                                cmd_status = play();
-                                break;
-                        case CMD_MSTOP:
-                                cmd_status = stop();
-                                break;
-                        case CMD_TEMPO:
-                                cmd_status = tempo();
-                                break;
-                        case CMD_MUSIC:
-                                cmd_status = music();
-                                break;
-                        case CMD_END:
-                        case CMD_STOP:
-                                cmd_status = prog_end();
-                                break;
-                        case CMD_LIST:
-                                cmd_status = list();
-                                break;
-                        case CMD_MEM:
-                                cmd_status = mem();
-                                break;
-                        case CMD_PEN:
-                                cmd_status = pen();
-                                break;
-                        case CMD_PAPER:
-                                cmd_status = paper();
-                                break;
-                        case CMD_NEXT:
-                                cmd_status = next();
-                                if (error_code)
-                                        break;
-                                cmd_status = gosub_return(CMD_NEXT);
-                                break;
-                        case CMD_LET:
-                                cmd_status = assignment();
-                                break;
-                        case CMD_GOSUB:
-                                cmd_status = gosub();
-                                break;
-                        case CMD_RETURN:
-                                cmd_status = gosub_return(CMD_RETURN);
-                                break;
-                        case CMD_RANDOMIZE:
-                                cmd_status = randomize();
-                                break;
-                        case CMD_RNDSEED:
-                                cmd_status = rndseed();
-                                break;
-                        case CMD_FOR:
-                                cmd_status = loopfor();
-                                break;
-                        case CMD_INPUT:
-                                cmd_status = input();
-                                break;
-                        case CMD_POKE:
-                                cmd_status = poke();
-                                break;
-                        case CMD_PSET:
-                                cmd_status = pset();
-                                break;
-                        case CMD_ELIST:
-                                cmd_status = elist();
-                                break;
-                        case CMD_EFORMAT:
-                                cmd_status = eformat();
-                                break;
-                        case CMD_ECHAIN:
-                                sys_config |= cfg_run_after_load;
-                                cmd_status = eload();
-                                break;
-                        case CMD_ESAVE:
-                                cmd_status = esave();
-                                break;
-                        case CMD_ELOAD:
-                                cmd_status = eload();
-                                break;
-                        case CMD_SSAVE:
-                                cmd_status = ssave();
-                                break;
-                        case CMD_SLOAD:
-                                cmd_status = sload();
-                                break;
-                        case CMD_RST:
-                                cmd_status = reset_display();
-                                break;
-                        case CMD_PRINT:
-                        case CMD_QMARK:
-                                cmd_status = print();
-                                break;
-                        case CMD_LOCATE:
-                                cmd_status = locate();
-                                break;
-                        case CMD_CLS:
-                                cmd_status = clear_screen();
-                                break;
-                        case CMD_REM:
-                        case CMD_HASH:
-                        case CMD_QUOTE:
-                                cmd_status = POST_CMD_NEXT_LINE;
-                                break;
-                        case CMD_PINDIR:
-                                cmd_status = pindir();
-                                break;
-                        case CMD_PINDWRITE:
-                                cmd_status = pindwrite();
-                                break;
-                        case CMD_UNKNOWN:
-                                cmd_status = assignment();
-                                break;
-                        default:
-                                error_code = 0xf;
-                                cmd_status = POST_CMD_WARM_RESET;
-                                break;
+                // some commands make sense only within a program
+                if (line_ptr == NULL && !(flags & CMD_FLAG_DIRECT)) {
+                        error_code = 0x18;
+                        return POST_CMD_WARM_RESET;
                 }
 
+                cmd_status = handler();
+
                 // check if should warm reset
                 if (cmd_status == POST_CMD_WARM_RESET)
                         return POST_CMD_WARM_RESET;
@@ -362,7 +490,7 @@ static uint8_t execution (void)
 
                 if (cmd_status == POST_CMD_NEXT_STATEMENT) {
                         ignorespace();
-                        if (*text_ptr == ':') {
+                        if ((flags & CMD_FLAG_CHAIN) && *text_ptr == ':') {
                                 text_ptr++;
                                 ignorespace();
                                 continue;
@@ -400,106 +528,194 @@ static void warm_reset (void)
         putchar (vid_cursor_on);
         // turn-on scroll
         putchar (vid_scroll_on);
+        // a program has ended or something failed --> default serial rate (see baud())
+        if ((line_ptr != NULL || error_code) && !(sys_config & cfg_from_serial))
+                ser_baud_default();
         // reset program-memory pointer
         line_ptr = 0;
-        stack_ptr = program_space + MEMORY_SIZE;
-        printmsg (msg_ok, stdout);
+        reset_stack();
+        // the program as it was, before any overlay was loaded
+        overlay_end();
+        // linked --> the status record takes the place of the prompt (see host_line())
+        if (!(sys_config & cfg_from_host))
+                printmsg (msg_ok, stdout);
 }
 
 /** ***************************************************************************
- * @brief Insert new line in the program.
+ * @brief Merge new line with the program.
  *
- * This function calculates the space needed by the new line and
- * moves existing code accordingly, so that the new line will fit.
+ * Program memory is a gap buffer: the lines before the gap begin at
+ * @c program_space and end at @c prog_end_ptr, while the lines after the gap
+ * begin at @c tail_ptr and end right below the line index. The gap is the free
+ * memory. This function moves the gap to the position of the new line, drops
+ * the line with the same number (if any) and appends the new line to the lines
+ * before the gap. Editing consecutive lines therefore costs time proportional
+ * to the size of the line, not of the program. A line numbered after the last
+ * line before the gap, while no lines follow the gap (the usual case, when a
+ * program is loaded), is appended in place: nothing is searched or moved.
  *
- * @note The position at which the new line should be inserted,
- * is specified by the @c text_ptr pointer.
+ * @note The new line (along with its header) is at the beginning of the gap
+ * and @c text_ptr points to it (see prep_line()). An empty line just deletes
+ * the line with the same number.
+ * @param length The length of the new line (including line header).
  *****************************************************************************/
-static void insert_line (LINE_LENGTH chars_to_copy)
+static void merge_line (LINE_LENGTH length)
 {
-        uint8_t *source, *dest, *new_end;
-        uint16_t tomove, room_to_make;
-
-        while (chars_to_copy > 0) {
-                // determine memory space to reserve
-                room_to_make = text_ptr - prog_end_ptr;
-                if (room_to_make > chars_to_copy)
-                        room_to_make = chars_to_copy;
-                new_end = prog_end_ptr + room_to_make;
-                tomove = prog_end_ptr - start;
-
-                // move existing code to make room
-                source = prog_end_ptr;
-                dest = new_end;
-                while (tomove > 0) {
-                        source--;
-                        dest--;
-                        *dest = *source;
-                        tomove--;
+        uint8_t *line;
+        LINE_NUMBER previous = 0;
+
+        rom_wait();
+        // the index would not follow the lines that move
+        if (index_valid)
+                drop_index();
+
+        if (line_number <= gap_line) {
+                // new line belongs before the gap --> move back the lines that follow it
+                line = program_space;
+                while (*((LINE_NUMBER *)line) < line_number) {
+                        previous = *((LINE_NUMBER *)line);
+                        line += line[sizeof (LINE_NUMBER)];
                 }
-
-                // copy content of new line
-                for (tomove = 0; tomove < room_to_make; tomove++) {
-                        *start = *text_ptr;
-                        text_ptr++;
-                        start++;
-                        chars_to_copy--;
+                move_gap (line - prog_end_ptr, length);
+                gap_line = previous;
+        } else {
+                // new line belongs after the gap --> move forward the lines that precede it
+                line = tail_ptr;
+                while (line != (uint8_t *)line_index && *((LINE_NUMBER *)line) < line_number) {
+                        gap_line = *((LINE_NUMBER *)line);
+                        line += line[sizeof (LINE_NUMBER)];
                 }
-                prog_end_ptr = new_end;
+                move_gap (line - tail_ptr, length);
+        }
+        if (error_code)
+                return;
+
+        // remove line with same line number
+        if (tail_ptr != (uint8_t *)line_index && *((LINE_NUMBER *)tail_ptr) == line_number)
+                tail_ptr += tail_ptr[sizeof (LINE_NUMBER)];
+
+        // append new line (if not empty) to the lines before the gap
+        if (text_ptr[sizeof (LINE_NUMBER) + sizeof (LINE_LENGTH)] != LF) {
+                prog_end_ptr += length;
+                gap_line = line_number;
         }
 }
 
 /** ***************************************************************************
- * @brief Remove line from program.
+ * @brief Close the gap of program memory.
  *
- * This function removes a line from the program and moves over
- * the remaining code.
+ * This function moves the lines after the gap right after the rest of the
+ * program, so that the program is contiguous and ends at @c prog_end_ptr.
+ * It is called before anything runs (or lists) the program. Since the
+ * lines are moved only once after a series of edits, the cost is not higher
+ * than that of walking the program.
  *
- * @note The line to be deleted is determined by the @c text_ptr pointer.
+ * @param carry The number of bytes at the beginning of the gap to keep
+ * (see move_gap()).
  *****************************************************************************/
-static void remove_line (void)
+static void close_gap (uint16_t carry)
 {
-        if (start != prog_end_ptr && * ((uint16_t *)start) == line_number) {
-                // calculate the space taken by the line to be deleted
-                uint8_t *dest, *from;
-                uint16_t tomove;
-                from = start + start[sizeof (uint16_t)];
-                dest = start;
-                // copy onver remaing code
-                tomove = prog_end_ptr - from;
-                while (tomove > 0) {
-                        *dest = *from;
-                        from++;
-                        dest++;
-                        tomove--;
+        uint8_t *line;
+
+        // the last line of the program will be the last line before the gap
+        for (line = tail_ptr; line != (uint8_t *)line_index; line += line[sizeof (LINE_NUMBER)])
+                gap_line = *((LINE_NUMBER *)line);
+        move_gap ((uint8_t *)line_index - tail_ptr, carry);
+}
+
+/** ***************************************************************************
+ * @brief Move the gap of program memory.
+ *
+ * This function moves the specified number of bytes from one side of the gap
+ * to the other. The first bytes of the gap (the line being entered) travel
+ * along with the gap and @c text_ptr, which points to them, is updated. If
+ * there is not enough free memory to move all bytes at once, the gap
+ * moves in steps.
+ *
+ * @param distance The number of bytes to move (negative to move the gap
+ * towards the beginning of the program).
+ * @param carry The number of bytes at the beginning of the gap to keep.
+ *****************************************************************************/
+static void move_gap (int16_t distance, uint16_t carry)
+{
+        uint16_t step;
+
+        while (distance != 0) {
+                // free memory that is not occupied by the carried bytes
+                step = tail_ptr - prog_end_ptr - carry;
+                if (step == 0) {
+                        error_code = 0x16;
+                        return;
+                }
+                if (distance > 0) {
+                        if (step > distance)
+                                step = distance;
+                        // make room, then move the first lines after the gap before it
+                        move_bytes (prog_end_ptr + step, prog_end_ptr, carry);
+                        move_bytes (prog_end_ptr, tail_ptr, step);
+                        tail_ptr += step;
+                        prog_end_ptr += step;
+                        text_ptr += step;
+                        distance -= step;
+                } else {
+                        if (step > -distance)
+                                step = -distance;
+                        // move the last lines before the gap after it, then carried bytes
+                        move_bytes (tail_ptr - step, prog_end_ptr - step, step);
+                        move_bytes (prog_end_ptr - step, prog_end_ptr, carry);
+                        tail_ptr -= step;
+                        prog_end_ptr -= step;
+                        text_ptr -= step;
+                        distance += step;
                 }
-                prog_end_ptr = dest;
         }
 }
 
 /** ***************************************************************************
- * @brief Move line at the end of program memory.
+ * @brief Copy a block of memory (the blocks may overlap).
  *
- * This function moves the newly entered line to the end of program memory.
- * It is executed whenever the user enters a new line and prior to the
- * interpretation / execution.
+ * @param dest The first byte of the destination.
+ * @param source The first byte of the source.
+ * @param count The number of bytes to copy.
  *****************************************************************************/
-static void move_line (void)
+static void move_bytes (uint8_t *dest, uint8_t *source, uint16_t count)
 {
-        /* find end of new line */
-        text_ptr = prog_end_ptr + sizeof (uint16_t);
-        while (*text_ptr != LF)
-                text_ptr++;
+        if (dest < source) {
+                while (count > 0) {
+                        *dest++ = *source++;
+                        count--;
+                }
+        } else {
+                dest += count;
+                source += count;
+                while (count > 0) {
+                        *--dest = *--source;
+                        count--;
+                }
+        }
+}
 
-        /* move line to the end of program_memory */
+/** ***************************************************************************
+ * @brief Move line at the end of free memory.
+ *
+ * This function moves the newly entered line to the end of free memory (the
+ * end of the gap, see merge_line()). It is executed whenever the user enters
+ * a new line, so that the line can be tokenized right after the program.
+ * When done, @c text_ptr points to the first character of the moved line.
+ *
+ * @param line The first character of the line.
+ * @param length The number of characters to move (including LF).
+ *****************************************************************************/
+static void move_line (uint8_t *line, uint16_t length)
+{
         uint8_t *dest;
-        dest = (uint8_t *)variables_ptr - 1;
-        while (1) {
-                *dest = *text_ptr;
-                if (text_ptr == prog_end_ptr + sizeof (uint16_t))
-                        break;
+        dest = tail_ptr;
+        line += length;
+        while (length > 0) {
                 dest--;
-                text_ptr--;
+                line--;
+                *dest = *line;
+                length--;
         }
         text_ptr = dest;
 }
@@ -509,19 +725,12 @@ static void move_line (void)
  *
  * This function calculates the memory space needed for the storing of line,
  * accounting fot the line number as well.
+ *
+ * @param length The length of the tokenized line (including LF).
  *****************************************************************************/
-static LINE_LENGTH prep_line (void)
+static LINE_LENGTH prep_line (LINE_LENGTH length)
 {
-        LINE_LENGTH length = 0;
-
-        /* find length of line */
-        while (text_ptr[length] != LF)
-                length++;
-
-        /* increase to account for LF */
-        length++;
-
-        /* increase even more for line-header */
+        /* increase to account for line-header */
         length += sizeof (LINE_NUMBER) + sizeof (LINE_LENGTH);
 
         /* move pointer to the beginning of line header */
@@ -543,6 +752,9 @@ static LINE_LENGTH prep_line (void)
  *****************************************************************************/
 static void error_message (void)
 {
+        // the host gets the error code as well (see host_line())
+        if (sys_config & cfg_from_host)
+                host_error();
         text_color (TXT_COL_ERROR);
         paper_color (0);
         switch (error_code) {
@@ -553,13 +765,7 @@ static void error_message (void)
                     printmsg_noNL (err_msg02, stdout);
                     if (line_ptr != NULL) {
                         printf (" -- ");
-                        uint8_t tmp = *text_ptr;
-                        if (*text_ptr != LF)
-                            *text_ptr = '^';
-
-                        uint8_t *list = line_ptr;
-                        printline (list, stdout);
-                        *text_ptr = tmp;
+                        printline (line_ptr, text_ptr, stdout);
                     }
                     newline (stdout);
                     break;
@@ -622,6 +828,27 @@ static void error_message (void)
                 case 0x15:      // expression expected
                     printmsg (err_msg15, stdout);
                     break;
+                case 0x16:      // not enough memory
+                    printmsg (err_msg16, stdout);
+                    break;
+                case 0x17:      // line too long
+                    printmsg (err_msg17, stdout);
+                    break;
+                case 0x18:      // not in direct mode
+                    printmsg (err_msg18, stdout);
+                    break;
+                case 0x19:      // invalid image
+                    printmsg (err_msg19, stdout);
+                    break;
+                case 0x1A:      // invalid file name
+                    printmsg (err_msg1A, stdout);
+                    break;
+                case 0x1B:      // file not found
+                    printmsg (err_msg1B, stdout);
+                    break;
+                case 0x1C:      // transfer failed
+                    printmsg (err_msg1C, stdout);
+                    break;
         }
         text_color (TXT_COL_DEFAULT);
         paper_color (0);
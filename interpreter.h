@@ -29,6 +29,11 @@
 
 uint16_t get_line_numberber (void);
 void basic_init (void);
+void clear_program (void);
+void build_index (void);
+void drop_index (void);
+void link_program (void);
+void unlink_program (void);
 void interpreter (void);
 
 // ------------------------------------------------------------------------------
@@ -45,12 +50,15 @@ void interpreter (void);
 
 #define MEMORY_SIZE (RAMEND - 1200)
 #define INPUT_BUFFER_SIZE 6
+#define MAX_LINE_LENGTH (255 - sizeof (LINE_NUMBER) - sizeof (LINE_LENGTH))
 #define MAX_FRAME_COUNT 5
 #define STACK_SIZE (sizeof( struct stack_for_frame ) * MAX_FRAME_COUNT)
 #define VAR_SIZE sizeof( int16_t )
 
 #define STACK_GOSUB_FLAG 'G'
 #define STACK_FOR_FLAG 'F'
+/** The line of the frame has been swapped out (see park_frames()). */
+#define STACK_SWAPPED 0x20
 
 // ------------------------------------------------------------------------------
 // ENUMERATORS
@@ -74,6 +82,18 @@ enum EXECUTION_STATUS {
 typedef uint16_t LINE_NUMBER;
 typedef uint8_t LINE_LENGTH;
 
+/** The command may be used in direct mode (without line number). */
+#define CMD_FLAG_DIRECT         0x01
+/** The command may be followed by another statement (separated by ':'). */
+#define CMD_FLAG_CHAIN          0x02
+/** The command does not affect the flow of execution or the stored program. */
+#define CMD_FLAG_SIMPLE         0x04
+
+struct command_entry {
+        uint8_t (*handler) (void);
+        uint8_t flags;
+};
+
 struct stack_for_frame {
         uint8_t frame_type;
         uint8_t for_var;
@@ -83,6 +103,11 @@ struct stack_for_frame {
         uint8_t *text_ptr;
 };
 
+struct line_index_entry {
+        LINE_NUMBER line_number;
+        uint16_t offset;
+};
+
 struct stack_gosub_frame {
         uint16_t frame_type;
         uint8_t *line_ptr;
@@ -98,6 +123,12 @@ extern const uint8_t msg_welcome[25];
 extern const uint8_t msg_ram_bytes[11];
 extern const uint8_t msg_rom_bytes[11];
 extern const uint8_t msg_available[17];
+extern const uint8_t msg_listing[8];
+extern const uint8_t msg_bytes[7];
+extern const uint8_t msg_packed[9];
+extern const uint8_t msg_stored[14];
+extern const uint8_t msg_buffered[23];
+extern const uint8_t msg_lost[7];
 extern const uint8_t msg_break[7];
 extern const uint8_t msg_ok[3];
 
@@ -124,19 +155,18 @@ extern const uint8_t err_msg12[23];
 extern const uint8_t err_msg13[13];
 extern const uint8_t err_msg14[24];
 extern const uint8_t err_msg15[21];
-
-// functions that return nothing / might print a value (definition in parser.c)
-extern const uint8_t commands[218];
-
-// functions that return a value / print nothing (definition in parser.c)
-extern const uint8_t functions[27];
-
-// relational operators (definition in parser.c)
-extern const uint8_t relop_table[12];
-
-// other keywords (definitions in parser.c)
-extern const uint8_t to_tab[3];
-extern const uint8_t step_tab[5];
+extern const uint8_t err_msg16[18];
+extern const uint8_t err_msg17[14];
+extern const uint8_t err_msg18[18];
+extern const uint8_t err_msg19[14];
+extern const uint8_t err_msg1A[18];
+extern const uint8_t err_msg1B[15];
+extern const uint8_t err_msg1C[16];
+
+// command handlers (definition in interpreter.c)
+extern const struct command_entry command_table[];
+
+// other keywords (definitions in parser.c, the keywords of the language are in keywords.h)
 extern const uint8_t highlow_tab[12];
 
 /** Holds the line number of current line. */
@@ -151,12 +181,24 @@ uint8_t input_buffer[INPUT_BUFFER_SIZE];
 uint8_t *variables_ptr;
 /** Pointer for accessing "internal" -- the one used by user programs. */
 uint8_t *stack_ptr;
+/** The innermost FOR frame of every variable (distance from the end of memory, 0 if unknown). */
+uint8_t for_frames[26];
 /** Pointer to current line in program memory -- the one being/to-be executed. */
 uint8_t *line_ptr;
 /** Pointer to character being examined or stored, when parsing or getting data. */
 uint8_t *text_ptr;
+/** Pointer to the first character of the line read by get_line(). */
+uint8_t *input_ptr;
 /** Pointer to last character of stored program. */
 uint8_t *prog_end_ptr;
+/** Pointer to the first line after the gap of program memory (see merge_line()). */
+uint8_t *tail_ptr;
+/** Sorted index of program lines (occupies the end of free memory). */
+struct line_index_entry *line_index;
+/** Indicates whether the line index covers the whole program. */
+uint8_t index_valid;
+/** Indicates whether GOTO/GOSUB targets have been resolved. */
+uint8_t program_linked;
 /** The upper bound fof stack space. */
 uint8_t *stack_limit;
 /** A special number that indicates the detected error. */
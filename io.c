@@ -35,10 +35,50 @@ FILE stream_physical = FDEV_SETUP_STREAM (putchar_phy, getchar_phy, _FDEV_SETUP_
 FILE stream_serial = FDEV_SETUP_STREAM (putchar_ser, getchar_ser, _FDEV_SETUP_RW);
 FILE stream_eeprom = FDEV_SETUP_STREAM (putchar_rom, getchar_rom, _FDEV_SETUP_RW);
 
+static void ser_baud_restore (void);
+static void ser_flow (uint8_t chr);
+static uint8_t ser_buffer_get (void);
+
 static uint8_t edge, kb_bit_cnt;
 static uint8_t kb_buffer_cnt;
 static uint8_t kb_buffer[KB_BUFFER_SIZE];
 
+// bytes received from the serial port (see the USART0_RX ISR)
+static volatile uint8_t ser_buffer_cnt;
+static uint8_t ser_buffer_read;
+static uint8_t ser_buffer_write;
+static uint8_t ser_buffer[SER_BUFFER_SIZE];
+// the sender has been stopped (XOFF)
+static volatile uint8_t ser_stopped;
+// no flow control and no CTRL+C (see ser_transparent())
+static volatile uint8_t ser_raw;
+// bytes waiting to be sent to the serial port (see the USART0_UDRE ISR)
+static volatile uint8_t ser_tx_cnt;
+static uint8_t ser_tx_read;
+static uint8_t ser_tx_write;
+static uint8_t ser_tx[SER_TX_BUFFER_SIZE];
+// flow control character to send ahead of the buffer (0 if none)
+static volatile uint8_t ser_flow_chr;
+// a rate other than BAUD has been selected (see ser_baud())
+static volatile uint8_t ser_baud_selected;
+// overflows of timer2 left, until the default rate is restored
+static volatile uint16_t ser_baud_timeout;
+
+#ifdef EEPROM_ASYNC
+// bytes of the EEPROM stream waiting to be written (at consecutive addresses)
+static volatile uint8_t ee_buffer_cnt;
+static volatile uint8_t ee_buffer_read;
+static uint8_t ee_buffer_write;
+static uint8_t ee_buffer[EE_BUFFER_SIZE];
+// block of memory waiting to be written (see rom_write_block())
+static const uint8_t * volatile ee_source;
+static volatile uint16_t ee_count;
+// the address of the next byte to write
+static volatile uint16_t ee_address;
+// writes wait, as without EEPROM_ASYNC (see rom_async())
+static uint8_t ee_sync;
+#endif
+
 // Array for the translation of keyboard scan codes to ASCII
 // 1st col: ASCII code when: SHIFT = 0 & CAPS = 0
 // 2nd col: ASCII code when: SHIFT = 1 & CAPS = 0
@@ -332,10 +372,9 @@ void init_io (void)
         peripheral_bus_dir |= to_apu;
 
         // setup UART connection
-        UBRR0H = UBRRH_VALUE;
-        UBRR0L = UBRRL_VALUE;
+        ser_baud_restore();
         UCSR0C = _BV (UCSZ01) | _BV (UCSZ00);   // 8bit data
-        UCSR0B = _BV (RXEN0) | _BV (TXEN0);     // enable RX - TX
+        UCSR0B = _BV (RXEN0) | _BV (TXEN0) | _BV (RXCIE0);     // enable RX - TX, RX interrupt
         uart_ansi_rst_clr();
 }
 
@@ -434,25 +473,237 @@ void uart_ansi_move_cursor (uint8_t row, uint8_t col)
 
 /** ***************************************************************************
  * @brief Send character to device attched on serial port.
+ *
+ * The character is placed in the transmit buffer, which is sent by the
+ * USART0_UDRE ISR. Only when the buffer is full does this function wait.
  *****************************************************************************/
 int putchar_ser (char chr, FILE *stream)
 {
         if (chr == LF)
-                putchar_ser (CR, stream);
-        loop_until_bit_is_set (UCSR0A, UDRE0);
-        UDR0 = chr;
+                ser_put (CR);
+        ser_put (chr);
         return 0;
 }
 
+/** ***************************************************************************
+ * @brief Send a byte to the serial port, as it is.
+ *
+ * The byte is placed in the transmit buffer (see putchar_ser()).
+ *****************************************************************************/
+void ser_put (uint8_t chr)
+{
+        while (ser_tx_cnt == SER_TX_BUFFER_SIZE)
+                ;
+        ser_tx[ser_tx_write] = chr;
+        ser_tx_write++;
+        if (ser_tx_write == SER_TX_BUFFER_SIZE)
+                ser_tx_write = 0;
+        cli();
+        ser_tx_cnt++;
+        UCSR0B |= _BV (UDRIE0);
+        sei();
+}
+
+/** ***************************************************************************
+ * @brief Get character from the serial port, waiting for a limited time.
+ *
+ * @param ms How long to wait (in milliseconds).
+ * @return The character, or -1 if none has arrived in time.
+ *****************************************************************************/
+int16_t ser_receive (uint16_t ms)
+{
+        uint8_t steps;
+
+        while (ser_buffer_cnt == 0) {
+                if (ms == 0)
+                        return -1;
+                for (steps = 0; steps < 100 && ser_buffer_cnt == 0; steps++)
+                        _delay_us (10);
+                ms--;
+        }
+        return ser_buffer_get();
+}
+
+/** ***************************************************************************
+ * @brief Pass binary data through the serial port.
+ *
+ * While transparent, received bytes are all stored (CTRL+C does not break)
+ * and the sender is not stopped with XON/XOFF: a block protocol that waits
+ * for replies needs neither (see xmodem_begin()).
+ *
+ * @param on Non-zero to become transparent, zero to restore flow control.
+ *****************************************************************************/
+void ser_transparent (uint8_t on)
+{
+        cli();
+        ser_raw = on;
+        if (ser_stopped) {
+                ser_stopped = 0;
+                ser_flow (XON);
+        }
+        sei();
+}
+
+/** ***************************************************************************
+ * @brief Wait until everything has been sent to the serial port.
+ *
+ * The last character has left the UART too, when this function returns.
+ *****************************************************************************/
+void ser_flush (void)
+{
+        // the ISR disables itself, when the buffer is empty
+        while (UCSR0B & _BV (UDRIE0))
+                ;
+        // something has been sent already (see init_io()), so TXC0 gets set
+        loop_until_bit_is_set (UCSR0A, TXC0);
+}
+
+/** ***************************************************************************
+ * @brief Set the default rate of the serial port (BAUD in Makefile).
+ *****************************************************************************/
+static void ser_baud_restore (void)
+{
+        TIMSK2 = 0;
+        ser_baud_timeout = 0;
+        ser_baud_selected = 0;
+        UBRR0H = UBRRH_VALUE;
+        UBRR0L = UBRRL_VALUE;
+        // leaves TXC0 alone (see ser_flush())
+#if USE_2X
+        UCSR0A = _BV (U2X0);
+#else
+        UCSR0A = 0;
+#endif
+}
+
+/** ***************************************************************************
+ * @brief Select the rate of the serial port.
+ *
+ * The normal mode is preferred; the double speed mode (U2X0) is used when the
+ * clock cannot be divided accurately enough otherwise. The characters waiting
+ * to be sent leave at the old rate. Unless a character arrives at the new
+ * rate within @c SER_BAUD_TIMEOUT, the default rate is restored (see the
+ * TIMER2_OVF ISR).
+ *
+ * @param rate The rate in bps.
+ * @return 1 if the rate was selected, 0 if it cannot be generated.
+ *****************************************************************************/
+uint8_t ser_baud (uint32_t rate)
+{
+        uint8_t mode;
+        uint32_t divisor, actual;
+
+        // normal mode divides the clock by 16, double speed mode by 8
+        for (mode = 16; mode != 0; mode -= 8) {
+                divisor = (F_CPU + mode * rate / 2) / (mode * rate);
+                if (divisor == 0 || divisor > 4096)
+                        continue;
+                // the same tolerance as util/setbaud.h (2%)
+                actual = F_CPU / (mode * divisor);
+                if (actual * 100 >= rate * 98 && actual * 100 <= rate * 102)
+                        break;
+        }
+        if (mode == 0)
+                return 0;
+
+        ser_flush();
+        cli();
+        UBRR0 = divisor - 1;
+        UCSR0A = (mode == 8) ? _BV (U2X0) : 0;
+        ser_baud_selected = 1;
+        // start counting (timer2 runs freely, see main())
+        ser_baud_timeout = SER_BAUD_TIMEOUT;
+        TIFR2 = _BV (TOV2);
+        TIMSK2 = _BV (TOIE2);
+        sei();
+        return 1;
+}
+
+/** ***************************************************************************
+ * @brief Restore the default rate of the serial port.
+ *
+ * Nothing happens, unless BAUD has selected another rate. The characters
+ * waiting to be sent leave at that rate first.
+ *****************************************************************************/
+void ser_baud_default (void)
+{
+        if (!ser_baud_selected)
+                return;
+        ser_flush();
+        cli();
+        ser_baud_restore();
+        sei();
+}
+
+/** ***************************************************************************
+ * @brief Send a flow control character.
+ *
+ * XON and XOFF are sent ahead of the transmit buffer (see the USART0_UDRE
+ * ISR). Interrupts must be disabled.
+ *****************************************************************************/
+static void ser_flow (uint8_t chr)
+{
+        ser_flow_chr = chr;
+        UCSR0B |= _BV (UDRIE0);
+}
+
+/** ***************************************************************************
+ * @brief Take a character out of the serial receive buffer.
+ *
+ * The buffer must not be empty. When it has drained enough, the sender is
+ * resumed (XON).
+ *****************************************************************************/
+static uint8_t ser_buffer_get (void)
+{
+        uint8_t chr = ser_buffer[ser_buffer_read];
+        ser_buffer_read++;
+        if (ser_buffer_read == SER_BUFFER_SIZE)
+                ser_buffer_read = 0;
+        cli();
+        ser_buffer_cnt--;
+        if (ser_stopped && ser_buffer_cnt <= SER_XON_LEVEL) {
+                ser_stopped = 0;
+                ser_flow (XON);
+        }
+        sei();
+        return chr;
+}
+
 /** ***************************************************************************
  * @brief Get character from device attched on serial port.
  *****************************************************************************/
 int getchar_ser (FILE *stream)
 {
+        while (ser_buffer_cnt == 0)
+                ;
+        return ser_buffer_get();
+}
+
+/** ***************************************************************************
+ * @brief Read a block from the serial port.
+ *
+ * This function waits for the first byte, then reads as many bytes as have
+ * arrived. It stops after the end of a line (LF, CR or NULL), so that the
+ * bytes that follow stay in the receive buffer.
+ *
+ * @param dest Where to store the bytes.
+ * @param count The maximum number of bytes to read.
+ * @return The number of bytes read.
+ *****************************************************************************/
+uint8_t ser_read_block (uint8_t *dest, uint8_t count)
+{
+        uint8_t done = 0;
         uint8_t chr;
-        loop_until_bit_is_set (UCSR0A, RXC0);
-        chr = UDR0;
-        return chr;
+
+        while (ser_buffer_cnt == 0)
+                ;
+        while (done < count && ser_buffer_cnt != 0) {
+                chr = ser_buffer_get();
+                dest[done++] = chr;
+                if (chr == LF || chr == CR || chr == 0)
+                        break;
+        }
+        return done;
 }
 
 /** ***************************************************************************
@@ -526,6 +777,33 @@ void send_to_apu (uint8_t cbyte)
  *****************************************************************************/
 int putchar_rom (char chr, FILE *stream)
 {
+#ifdef EEPROM_ASYNC
+        uint8_t consecutive;
+        if (!ee_sync) {
+                // the buffer holds consecutive bytes only
+                cli();
+                consecutive = (ee_count == 0 && (ee_buffer_cnt == 0 || ee_address + ee_buffer_cnt == eeprom_ptr));
+                sei();
+                if (!consecutive)
+                        rom_wait();
+                while (ee_buffer_cnt == EE_BUFFER_SIZE)
+                        ;
+                if (ee_buffer_cnt == 0)
+                        ee_address = eeprom_ptr;
+                ee_buffer[ee_buffer_write] = chr;
+                ee_buffer_write++;
+                if (ee_buffer_write == EE_BUFFER_SIZE)
+                        ee_buffer_write = 0;
+                cli();
+                ee_buffer_cnt++;
+                EECR |= _BV (EERIE);
+                sei();
+                eeprom_ptr++;
+                return 0;
+        }
+        // after the bytes written in the background
+        rom_wait();
+#endif
         eeprom_update_byte ((uint8_t *) eeprom_ptr++, chr);
         return 0;
 }
@@ -534,13 +812,111 @@ int putchar_rom (char chr, FILE *stream)
  * @brief Get character in EEPROM.
  *
  * This function reads a character from EEPROM. It is used by the EEPROM stream.
+ * Reading stops at @c eeprom_end.
  *****************************************************************************/
 int getchar_rom (FILE *stream)
 {
+        // past the end of the data --> as if it ended with NULL
+        if (eeprom_ptr >= eeprom_end)
+                return 0;
+        rom_wait();
         uint8_t chr = eeprom_read_byte ((uint8_t *) eeprom_ptr++);
         return chr;
 }
 
+/** ***************************************************************************
+ * @brief Read a block from EEPROM.
+ *
+ * The block is read from @c eeprom_ptr, which is advanced. Reading stops at
+ * @c eeprom_end.
+ *
+ * @param dest Where to store the bytes.
+ * @param count The number of bytes to read.
+ * @return The number of bytes read (0 at the end of the data).
+ *****************************************************************************/
+uint8_t rom_read_block (uint8_t *dest, uint8_t count)
+{
+        if (eeprom_ptr >= eeprom_end)
+                return 0;
+        if (count > eeprom_end - eeprom_ptr)
+                count = eeprom_end - eeprom_ptr;
+        rom_wait();
+        eeprom_read_block (dest, (void *)eeprom_ptr, count);
+        eeprom_ptr += count;
+        return count;
+}
+
+/** ***************************************************************************
+ * @brief Write a block of memory to EEPROM.
+ *
+ * The block is written in the background, one byte at a time, whenever the
+ * EEPROM is ready (see the EE_READY ISR). Bytes that would not change are not
+ * written. The block should not change until everything has been written
+ * (see rom_wait()). Without @c EEPROM_ASYNC, or if writes should wait (see
+ * rom_async()), the block is written right away.
+ *****************************************************************************/
+void rom_write_block (const uint8_t *source, uint16_t address, uint16_t count)
+{
+#ifdef EEPROM_ASYNC
+        rom_wait();
+        if (count == 0)
+                return;
+        if (!ee_sync) {
+                ee_source = source;
+                ee_address = address;
+                cli();
+                ee_count = count;
+                EECR |= _BV (EERIE);
+                sei();
+                return;
+        }
+#endif
+        eeprom_update_block (source, (void *)address, count);
+}
+
+/** ***************************************************************************
+ * @brief Wait until all EEPROM writes are complete.
+ *
+ * This function should be called before reading the EEPROM and before
+ * changing a block that is being written.
+ *****************************************************************************/
+void rom_wait (void)
+{
+#ifdef EEPROM_ASYNC
+        // the interrupt is disabled when there is nothing left to write
+        while (EECR & _BV (EERIE))
+                ;
+#endif
+        eeprom_busy_wait();
+}
+
+/** ***************************************************************************
+ * @brief Write to EEPROM in the background, or not (ESYNC).
+ *
+ * When off, putchar_rom() and rom_write_block() return once the bytes have
+ * been written. Without @c EEPROM_ASYNC, they always do.
+ *****************************************************************************/
+void rom_async (uint8_t on)
+{
+#ifdef EEPROM_ASYNC
+        ee_sync = !on;
+#endif
+}
+
+/** ***************************************************************************
+ * @brief Get the number of bytes waiting to be written to EEPROM.
+ *****************************************************************************/
+uint16_t rom_pending (void)
+{
+        uint16_t count = 0;
+#ifdef EEPROM_ASYNC
+        cli();
+        count = ee_count + ee_buffer_cnt;
+        sei();
+#endif
+        return count;
+}
+
 /** ***************************************************************************
  * @brief Change on-screen text colour.
  *
@@ -592,6 +968,127 @@ void put_pixel (uint8_t x, uint8_t y, uint8_t color)
         putchar (color);
 }
 
+#ifdef EEPROM_ASYNC
+/** ***************************************************************************
+ * @brief ISR: Write the next byte to EEPROM.
+ *
+ * The block of memory is written first, then the bytes of the EEPROM stream.
+ * When nothing is left, the interrupt disables itself.
+ *****************************************************************************/
+ISR (EE_READY_vect)
+{
+        uint8_t data;
+        if (ee_count != 0) {
+                data = *ee_source;
+                ee_source++;
+                ee_count--;
+        } else if (ee_buffer_cnt != 0) {
+                data = ee_buffer[ee_buffer_read];
+                ee_buffer_read++;
+                if (ee_buffer_read == EE_BUFFER_SIZE)
+                        ee_buffer_read = 0;
+                ee_buffer_cnt--;
+        } else {
+                EECR &= ~_BV (EERIE);
+                return;
+        }
+        // write only if the byte changes (erase and write take 3.4ms)
+        EEAR = ee_address;
+        ee_address++;
+        EECR |= _BV (EERE);
+        if (EEDR != data) {
+                // erasing or writing an erased byte takes half the time
+                if (data == EEPROM_ERASED)
+                        EECR = _BV (EERIE) | _BV (EEPM0);
+                else if (EEDR == EEPROM_ERASED)
+                        EECR = _BV (EERIE) | _BV (EEPM1);
+                else
+                        EECR = _BV (EERIE);
+                EEDR = data;
+                EECR |= _BV (EEMPE);
+                EECR |= _BV (EEPE);
+        }
+}
+#endif
+
+/** ***************************************************************************
+ * @brief ISR: Store a byte received from the serial port.
+ *
+ * CTRL+C is not stored, but breaks the program. When the buffer is nearly
+ * full the sender is stopped (XOFF); bytes that do not fit are lost and
+ * counted.
+ *****************************************************************************/
+ISR (USART0_RX_vect)
+{
+        uint8_t status = UCSR0A;
+        uint8_t chr = UDR0;
+
+        // the UART has lost the bytes before this one
+        if (status & _BV (DOR0))
+                ser_overruns++;
+        // a character at the selected rate --> keep it
+        if (ser_baud_timeout != 0 && !(status & _BV (FE0))) {
+                ser_baud_timeout = 0;
+                TIMSK2 = 0;
+        }
+        if (chr == ETX && !ser_raw) {
+                break_flow = 1;
+                return;
+        }
+        if (ser_buffer_cnt == SER_BUFFER_SIZE) {
+                ser_overruns++;
+                return;
+        }
+        ser_buffer[ser_buffer_write] = chr;
+        ser_buffer_write++;
+        if (ser_buffer_write == SER_BUFFER_SIZE)
+                ser_buffer_write = 0;
+        ser_buffer_cnt++;
+        if (ser_buffer_cnt > ser_high_water)
+                ser_high_water = ser_buffer_cnt;
+        if (!ser_raw && !ser_stopped && ser_buffer_cnt >= SER_XOFF_LEVEL) {
+                ser_stopped = 1;
+                ser_flow (XOFF);
+        }
+}
+
+/** ***************************************************************************
+ * @brief ISR: Send the next byte to the serial port.
+ *
+ * A pending flow control character goes first, then the transmit buffer.
+ * When nothing is left, the interrupt disables itself.
+ *****************************************************************************/
+ISR (USART0_UDRE_vect)
+{
+        if (ser_flow_chr != 0) {
+                UDR0 = ser_flow_chr;
+                ser_flow_chr = 0;
+        } else if (ser_tx_cnt != 0) {
+                UDR0 = ser_tx[ser_tx_read];
+                ser_tx_read++;
+                if (ser_tx_read == SER_TX_BUFFER_SIZE)
+                        ser_tx_read = 0;
+                ser_tx_cnt--;
+        } else {
+                UCSR0B &= ~_BV (UDRIE0);
+                return;
+        }
+        // clear TXC0 (see ser_flush()), keep U2X0 and leave the flags alone
+        UCSR0A = (UCSR0A & _BV (U2X0)) | _BV (TXC0);
+}
+
+/** ***************************************************************************
+ * @brief ISR: Restore the default rate, if nothing arrives at the new one.
+ *
+ * The interrupt is enabled by ser_baud() only.
+ *****************************************************************************/
+ISR (TIMER2_OVF_vect)
+{
+        ser_baud_timeout--;
+        if (ser_baud_timeout == 0)
+                ser_baud_restore();
+}
+
 /** ***************************************************************************
  * @brief ISR: Check if user pressed break button.
  *****************************************************************************/
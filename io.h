@@ -43,16 +43,43 @@ void send_to_apu (uint8_t cbyte);
 // cannot use uintXX_t because of how FILE is defined
 int putchar_ser (char c, FILE *stream);
 int getchar_ser (FILE *stream);
+void ser_flush (void);
+void ser_put (uint8_t chr);
+int16_t ser_receive (uint16_t ms);
+void ser_transparent (uint8_t on);
+uint8_t ser_baud (uint32_t rate);
+void ser_baud_default (void);
 int putchar_phy (char c, FILE *stream);
 int getchar_phy (FILE *stream);
 int putchar_rom (char c, FILE *stream);
 int getchar_rom (FILE *stream);
 
+// block readers (see read_stream())
+uint8_t rom_read_block (uint8_t *dest, uint8_t count);
+uint8_t ser_read_block (uint8_t *dest, uint8_t count);
+
+// EEPROM writer
+void rom_write_block (const uint8_t *source, uint16_t address, uint16_t count);
+void rom_wait (void);
+uint16_t rom_pending (void);
+void rom_async (uint8_t on);
+
 // ------------------------------------------------------------------------------
 // MACROS
 // ------------------------------------------------------------------------------
 
 #define KB_BUFFER_SIZE  16
+#define EE_BUFFER_SIZE  32
+#define SER_BUFFER_SIZE 64
+#define SER_TX_BUFFER_SIZE 32
+/* the sender is stopped (XOFF) when the receive buffer fills up to this level
+ * and resumed (XON) when it drains to the other; the rest takes the bytes
+ * that are already on the way */
+#define SER_XOFF_LEVEL  (SER_BUFFER_SIZE - 16)
+#define SER_XON_LEVEL   (SER_BUFFER_SIZE / 4)
+/* a rate selected by BAUD is abandoned, unless a character arrives within
+ * this many overflows of timer2 (about 5 seconds) */
+#define SER_BAUD_TIMEOUT (F_CPU / 1024 / 256 * 5)
 
 /* data bus to GPU and APU */
 #define pri_data_bus_dir    DDRC
@@ -101,7 +128,10 @@ int getchar_rom (FILE *stream);
 #define SPACE           0x20    // SPACE
 #define BS              0x08    // BACKSPACE
 #define ESC             0x1B    // ESC
+#define SUB             0x1A    // CTRL+Z (end of file, pads XMODEM blocks)
 #define ETX             0x03    // CTRL+C
+#define XON             0x11    // CTRL+Q
+#define XOFF            0x13    // CTRL+S
 #define DQUOTE          0x22    //
 #define SQUOTE          0x27    //
 
@@ -165,12 +195,26 @@ FILE stream_physical, stream_serial, stream_eeprom;
  */
 uint16_t eeprom_ptr;
 
+/**
+ * The end of the data being read from EEPROM (the stream reads NULL
+ * characters past it).
+ */
+uint16_t eeprom_end;
+
 /**
  * This variable signifies whether the user
  * has pressed the BREAK button or CTR+c.
  */
 uint8_t break_flow;
 
+/**
+ * Statistics of the serial receiver (see MEM): the bytes that were lost
+ * (the buffer was full or the UART overran) and the most bytes that have
+ * been waiting in the buffer.
+ */
+volatile uint16_t ser_overruns;
+volatile uint8_t ser_high_water;
+
 // keyboard connectivity messages (definitions in printing.c)
 extern const uint8_t kb_fail_msg[26];
 extern const uint8_t kb_success_msg[32];
@@ -30,12 +30,17 @@
 int main (void)
 {
         init_io();
-        text_color (TXT_COL_DEFAULT);
-        paper_color (0);
-        printmsg (msg_welcome, stdout);
-        do_beep();
+        // snapshot in EEPROM --> resume it at once, skip the welcome
+        if (find_snapshot())
+                sys_config |= cfg_auto_run;
+        else {
+                text_color (TXT_COL_DEFAULT);
+                paper_color (0);
+                printmsg (msg_welcome, stdout);
+                do_beep();
+        }
 
-        // configure timer2 (used for seed generation)
+        // configure timer2 (used for seed generation and by BAUD, see ser_baud())
         TCCR2A = 0;
         TCCR2B = _BV (CS22) | _BV (CS21) | _BV (CS20);
         TIMSK2 = 0;
@@ -47,32 +52,68 @@ int main (void)
 }
 
 /** ***************************************************************************
- * @brief Read from SERIAL or EEPROM.
+ * @brief Stop loading a program from SERIAL or EEPROM.
+ *
+ * An XMODEM transfer that has not ended yet is cancelled (see xload()).
+ *****************************************************************************/
+static void stop_stream (void)
+{
+        if ((sys_config & cfg_from_xmodem) && xmodem_end() && error_code == 0)
+                error_code = 0x1C;
+        sys_config &= ~(cfg_from_serial | cfg_from_eeprom | cfg_from_xmodem);
+}
+
+/** ***************************************************************************
+ * @brief Read a line from SERIAL or EEPROM.
  *
- * Keep reading from SERIAL or eeprom until a NULL character is received.
+ * Blocks of bytes are read straight to @c text_ptr, until the end of the line
+ * (LF, CR or the SUB that pads XMODEM blocks, replaced by LF). A NULL
+ * character (or the end of the data, for EEPROM) marks the end of the
+ * program: loading stops. So does a line that is longer than
+ * @c MAX_LINE_LENGTH or does not fit in free memory, with an error.
  *****************************************************************************/
+static void read_stream (void)
+{
+        uint8_t *limit = text_ptr + MAX_LINE_LENGTH;
+        uint8_t count, i, chr;
+
+        // leave room for LF
+        if (limit > tail_ptr - 1)
+                limit = tail_ptr - 1;
 
-void read_serial_eeprom (FILE input_stream) {
-        uint8_t in_chr;
         while (1) {
-                in_chr = fgetc (&input_stream);
-                switch (in_chr) {
-                        // NULL -> stop reading
-                        case 0:
-                                sys_config &= ~cfg_from_serial;
-                                sys_config &= ~cfg_from_eeprom;
-                                return;
-                        // LINE FEED or CARRIAGE RETURN -> LINE FEED
-                        case LF:
-                        case CR:
+                if (text_ptr == limit) {
+                        error_code = (limit == tail_ptr - 1) ? 0x16 : 0x17;
+                        break;
+                }
+                count = (limit - text_ptr > STREAM_BLOCK) ? STREAM_BLOCK : limit - text_ptr;
+                if (sys_config & cfg_from_eeprom)
+                        count = rom_read_block (text_ptr, count);
+                else if (sys_config & cfg_from_xmodem)
+                        count = xmodem_read (text_ptr, count);
+                else
+                        count = ser_read_block (text_ptr, count);
+                // end of data --> as if NULL was read
+                if (count == 0)
+                        break;
+                for (i = 0; i < count; i++) {
+                        chr = text_ptr[i];
+                        if (chr == 0 || chr == LF || chr == CR || chr == SUB) {
+                                // the bytes after the line are read again, next time
+                                if (sys_config & cfg_from_eeprom)
+                                        eeprom_ptr -= count - i - 1;
+                                text_ptr += i;
                                 text_ptr[0] = LF;
+                                if (chr == 0)
+                                        stop_stream();
                                 return;
-                        // OTHER CHARACTERS -> PUT IN BUFFER
-                        default:
-                                text_ptr[0] = in_chr;
-                                text_ptr++;
+                        }
                 }
+                text_ptr += count;
         }
+        // end of data or error --> stop reading
+        stop_stream();
+        text_ptr[0] = LF;
 }
 
 /** ***************************************************************************
@@ -84,21 +125,36 @@ void read_serial_eeprom (FILE input_stream) {
  * source) the function will keep getting lines until a NULL character is
  * received. If new data is to be received from STDIN (the user himself)
  * the fuinction will only get a single line.
+ *
+ * Lines of a program being loaded are read @c STREAM_OFFSET bytes after the
+ * program, so that tokenize() can store them right after the program without
+ * moving them first (see interpreter()). The first character of the line is
+ * pointed by @c input_ptr. Such lines are read in blocks by read_stream(); a
+ * line that does not fit stops loading with an error. Lines from the host
+ * (see host()) are read the same way, one frame at a time, by host_line().
  *****************************************************************************/
 void get_line (void)
 {
         text_ptr = prog_end_ptr + sizeof (uint16_t);
 
+        /* loading --> read above the tokenized line, if there is room (no move needed) */
+        if ((sys_config & (cfg_from_eeprom | cfg_from_serial | cfg_from_host)) && tail_ptr - prog_end_ptr >= 2 * STREAM_OFFSET)
+                text_ptr = prog_end_ptr + STREAM_OFFSET;
+        input_ptr = text_ptr;
+        /* not typed --> might be read over an image that is being saved (see save_slot()) */
+        if (sys_config & (cfg_from_eeprom | cfg_from_serial | cfg_from_host))
+                rom_wait();
+
         uint8_t *maxpos = text_ptr;
         uint8_t in_char, temp1, temp2;
 
-        /* READ FROM EEPROM */
-        if (sys_config & cfg_from_eeprom) {
-                read_serial_eeprom (stream_eeprom);
+        /* READ FROM EEPROM OR SERIAL */
+        if (sys_config & (cfg_from_eeprom | cfg_from_serial)) {
+                read_stream();
 
-        /* READ FROM SERIAL */
-        } else if (sys_config & cfg_from_serial) {
-                read_serial_eeprom (stream_serial);
+        /* READ FROM THE HOST */
+        } else if (sys_config & cfg_from_host) {
+                host_line();
 
         /* READ FROM STDIN */
         } else {
@@ -180,7 +236,13 @@ void get_line (void)
                                         break;
                                 // OTHER CHARACTERS
                                 default:
-                                        if (text_ptr == variables_ptr - 2)
+                                        // release line index, if more room is needed
+                                        if (text_ptr == tail_ptr - 2 && index_valid)
+                                                drop_index();
+                                        // past the room kept for the line --> the image being saved is next
+                                        if (text_ptr == prog_end_ptr + STREAM_OFFSET)
+                                                rom_wait();
+                                        if (text_ptr == tail_ptr - 2)
                                                 do_beep();
                                         else {
                                                 putchar (in_char);
@@ -215,11 +277,32 @@ uint8_t pop_byte (void)
 }
 
 /** ***************************************************************************
+ * @brief Find the line with specified number.
  *
+ * This function returns the first line whose number is greater than or equal
+ * to @c line_number (or the end of the program). If the line index is valid,
+ * binary search is used. Otherwise, the program is walked line by line.
  *****************************************************************************/
 uint8_t *find_line (void)
 {
         uint8_t *line = program_space;
+        struct line_index_entry *first, *last, *middle;
+
+        if (index_valid) {
+                first = line_index;
+                last = (struct line_index_entry *)variables_ptr;
+                while (first < last) {
+                        middle = first + (last - first) / 2;
+                        if (middle->line_number < line_number)
+                                first = middle + 1;
+                        else
+                                last = middle;
+                }
+                if (first == (struct line_index_entry *)variables_ptr)
+                        return prog_end_ptr;
+                return program_space + first->offset;
+        }
+
         while (1) {
                 if (line == prog_end_ptr)
                         return line;
@@ -251,7 +334,7 @@ void ignorespace (void)
 void uppercase (void)
 {
         uint8_t quote = 0;
-        uint8_t *chr = prog_end_ptr + sizeof (uint16_t);
+        uint8_t *chr = input_ptr;
 
         while (*chr != LF) {
                 // current character == stored quote
@@ -296,7 +379,7 @@ void fx_delay_us (uint16_t us)
  *****************************************************************************/
 uint8_t break_test (void)
 {
-        if (break_flow || UDR0 == ETX) {
+        if (break_flow) {
                 break_flow = 0;
                 return 1;
         }
@@ -328,3 +411,57 @@ int16_t str_to_num (uint8_t *strptr)
         else
                 return value;
 }
+
+/** ***************************************************************************
+ * @brief Check if a character may be part of a file name.
+ *
+ * File names consist of letters, digits, dots, dashes and underscores.
+ *****************************************************************************/
+uint8_t valid_filename_char (uint8_t c)
+{
+        if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9'))
+                return 1;
+        return c == '.' || c == '-' || c == '_';
+}
+
+/** ***************************************************************************
+ * @brief Get a file name.
+ *
+ * The name is expected in quotes (single or double) and it is checked with
+ * valid_filename_char(). It should be at most @c FILENAME_SIZE characters.
+ * When done, @c text_ptr points right after the closing quote.
+ *
+ * @return The name, padded with zeros, or NULL if it is not valid.
+ *****************************************************************************/
+uint8_t * valid_filename (void)
+{
+        static uint8_t filename[FILENAME_SIZE];
+        uint8_t delim, length = 0;
+
+        ignorespace();
+        delim = *text_ptr;
+        if (delim != DQUOTE && delim != SQUOTE) {
+                error_code = 0x1A;
+                return NULL;
+        }
+        text_ptr++;
+        while (*text_ptr != delim) {
+                if (length == FILENAME_SIZE || !valid_filename_char (*text_ptr)) {
+                        error_code = 0x1A;
+                        return NULL;
+                }
+                filename[length] = *text_ptr;
+                length++;
+                text_ptr++;
+        }
+        text_ptr++;
+        if (length == 0) {
+                error_code = 0x1A;
+                return NULL;
+        }
+        while (length < FILENAME_SIZE) {
+                filename[length] = 0;
+                length++;
+        }
+        return filename;
+}
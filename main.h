@@ -43,7 +43,7 @@ void get_line (void);
 
 uint8_t break_test (void);
 
-uint16_t valid_filename_char (uint8_t c);
+uint8_t valid_filename_char (uint8_t c);
 uint8_t * valid_filename (void);
 
 void fx_delay_ms (uint16_t ms);
@@ -57,6 +57,14 @@ void fx_delay_us (uint16_t us);
 #define cfg_run_after_load  2  // 2nd bit
 #define cfg_from_serial     4  // 3rd bit
 #define cfg_from_eeprom     8  // 4th bit
+#define cfg_from_xmodem     16 // 5th bit (along with cfg_from_serial, see xload())
+#define cfg_from_host       32 // 6th bit (see host())
+#define cfg_text_only       64 // 7th bit (see compile())
+
+/** Where loaded lines are read, past the longest tokenized line (see get_line()). */
+#define STREAM_OFFSET (sizeof (LINE_NUMBER) + sizeof (LINE_LENGTH) + MAX_LINE_LENGTH)
+/** The most bytes read from EEPROM or SERIAL at once (see read_stream()). */
+#define STREAM_BLOCK 32
 
 // ------------------------------------------------------------------------------
 // GLOBALS
@@ -69,6 +77,7 @@ void fx_delay_us (uint16_t us);
  * - auto run after load (chain)
  * - get data from serial
  * - get data from eeprom
+ * - get lines from the host (see host())
  */
 
 uint8_t sys_config;
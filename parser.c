@@ -22,13 +22,12 @@
  * @file parser.c
  * @brief Syntactic analysis and expression evaluation.
  *
- * The functions @c parse_expr_s# call each other recursivelly, until the given expression is
- * evaluated. The first of them handles relational operators, the second one handles additions
- * and sutractions, the third handles multiplications and divisions, while the fourth substitutes
- * variables with the respective values, calls other arithmetic functions, or could even start
- * the whole 'chain' of parsing from the beginning, in order to evaluate a sub-expression. The
- * representation of a mathematical expression in the form of a tree could help understand why
- * this works and how the operator precedence is honored. The rest functions parse the special
+ * Expressions are evaluated by parse_expr() without recursion: operands go straight to a stack
+ * of values, while operators wait in a second stack until every operator of higher precedence
+ * has been applied. Relational operators have the lowest precedence, followed by additions and
+ * subtractions, multiplications and divisions and finally the minus sign. Parentheses and
+ * function calls are kept in the stack of operators as markers. Both stacks have a fixed size,
+ * so the memory needed for any expression is known beforehand. The rest functions parse the special
  * strings used for describing sequences of notes and in essence, complete melodies.
  */
 
@@ -36,87 +35,7 @@
 
 /// @cond BASIC_KEYWORDS
 
-// functions which cannot be part of a larger expression (return nothing / might print a value)
-const uint8_t commands[218] PROGMEM = {
-                'L', 'I', 'S', 'T' + 0x80,
-                'N', 'E', 'W' + 0x80,
-                'R', 'U', 'N' + 0x80,
-                'N', 'E', 'X', 'T' + 0x80,
-                'L', 'E', 'T' + 0x80,
-                'I', 'F' + 0x80,
-                'G', 'O', 'T', 'O' + 0x80,
-                'M', 'P', 'L', 'A', 'Y' + 0x80,
-                'M', 'S', 'T', 'O', 'P' + 0x80,
-                'T', 'E', 'M', 'P', 'O' + 0x80,
-                'M', 'U', 'S', 'I', 'C' + 0x80,
-                'G', 'O', 'S', 'U', 'B' + 0x80,
-                'R', 'E', 'T', 'U', 'R', 'N' + 0x80,
-                'R', 'A', 'N', 'D', 'O', 'M', 'I', 'Z', 'E' + 0x80,
-                'R', 'N', 'D', 'S', 'E', 'E', 'D' + 0x80,
-                'R', 'S', 'T' + 0x80,
-                'C', 'L', 'S' + 0x80,
-                'R', 'E', 'M' + 0x80,
-                'F', 'O', 'R' + 0x80,
-                'I', 'N', 'P', 'U', 'T' + 0x80,
-                'B', 'E', 'E', 'P' + 0x80,
-                'P', 'R', 'I', 'N', 'T' + 0x80,
-                'L', 'O', 'C', 'A', 'T', 'E' + 0x80,
-                'P', 'O', 'K', 'E' + 0x80,
-                'P', 'S', 'E', 'T' + 0x80,
-                'S', 'T', 'O', 'P' + 0x80,
-                'E', 'N', 'D' + 0x80,
-                'M', 'E', 'M' + 0x80,
-                'P', 'E', 'N' + 0x80,
-                'P', 'A', 'P', 'E', 'R' + 0x80,
-                '?' + 0x80,
-                '#' + 0x80,
-                '\'' + 0x80,
-                'D', 'E', 'L', 'A', 'Y' + 0x80,
-                'E', 'L', 'I', 'S', 'T' + 0x80,
-                'E', 'F', 'O', 'R', 'M', 'A', 'T' + 0x80,
-                'E', 'C', 'H', 'A', 'I', 'N' + 0x80,
-                'E', 'S', 'A', 'V', 'E' + 0x80,
-                'E', 'L', 'O', 'A', 'D' + 0x80,
-                'S', 'S', 'A', 'V', 'E' + 0x80,
-                'S', 'L', 'O', 'A', 'D' + 0x80,
-                'F', 'I', 'L', 'E', 'S' + 0x80,
-                'C', 'F', 'O', 'R', 'M', 'A', 'T' + 0x80,
-                'C', 'C', 'H', 'A', 'I', 'N' + 0x80,
-                'C', 'S', 'A', 'V', 'E' + 0x80,
-                'C', 'L', 'O', 'A', 'D' + 0x80,
-                'P', 'I', 'N', 'D', 'I', 'R' + 0x80,
-                'P', 'I', 'N', 'D', 'W', 'R', 'I', 'T', 'E' + 0x80,
-                0
-        };
-// functions that must be part of a larger expression (return a value / print nothing)
-const uint8_t functions[27] PROGMEM = {
-                'P', 'E', 'E', 'K' + 0x80,
-                'A', 'B', 'S' + 0x80,
-                'R', 'N', 'D' + 0x80,
-                'P', 'I', 'N', 'D', 'R', 'E', 'A', 'D' + 0x80,
-                'P', 'I', 'N', 'A', 'R', 'E', 'A', 'D' + 0x80,
-                0
-        };
-// relational operators
-const uint8_t relop_table[12] PROGMEM = {
-                '>', '=' + 0x80,
-                '<', '>' + 0x80,
-                '>' + 0x80,
-                '=' + 0x80,
-                '<', '=' + 0x80,
-                '<' + 0x80,
-                '!', '=' + 0x80,
-                0
-        };
-// other keywords
-const uint8_t to_tab[3] PROGMEM = {
-                'T', 'O' + 0x80,
-                0
-        };
-const uint8_t step_tab[5] PROGMEM = {
-                'S', 'T', 'E', 'P' + 0x80,
-                0
-        };
+// other keywords (the keywords of the language are in keywords.c, see keywords.def)
 const uint8_t highlow_tab[12] PROGMEM = {
                 'H', 'I', 'G', 'H' + 0x80,
                 'H', 'I' + 0x80,
@@ -127,57 +46,183 @@ const uint8_t highlow_tab[12] PROGMEM = {
 
 /// @endcond
 
-static int16_t parse_expr_s2 (void);
-static int16_t parse_expr_s3 (void);
-static int16_t parse_expr_s4 (void);
+static uint8_t precedence (uint8_t op);
+static uint8_t output (uint8_t op, int16_t value, int16_t *values, uint8_t count);
 static uint8_t get_note (void);
 static uint8_t get_effect (void);
 static uint8_t get_duration (void);
 static uint8_t get_octave (void);
 
 /** ***************************************************************************
- * @brief Search for any string in specified table.
+ * @brief Search for a keyword.
  *
- * This function scans current line and looks for any string contained in the
- * specified array.
+ * This function checks whether a keyword begins at the current character. The
+ * keywords are stored in a trie (see keywords.def and tools/keywords.py), so
+ * the time needed depends on the length of the keyword and not on its position
+ * in the keyword tables. Text that is no keyword (e.g. a variable) is rejected
+ * right after its first or second character.
  *
- * @note Scanning begins at the character pointed to by @c text_ptr.
- * @param table A pointer to an array of strings, located in FLASH.
- * @return The position (index) of the detected string in array.
+ * @note Scanning begins at the character pointed to by @c text_ptr. If a
+ * keyword is found, the pointer is moved after it.
+ * @return The token of the keyword, or 0 if there is no keyword.
  *****************************************************************************/
-int8_t scantable (const uint8_t *table)
+uint8_t scankeyword (void)
 {
-        int8_t position = 0;
-        uint16_t pos = 0;
+        const uint8_t *edge, *last;
+        uint8_t *ptr = text_ptr;
+        uint8_t token = 0;
+        uint16_t offset;
+
+        if (*ptr < KEYWORD_FIRST || *ptr > KEYWORD_LAST)
+                return 0;
+        offset = pgm_read_word (&keyword_index[*ptr - KEYWORD_FIRST]);
+        if (offset == KEYWORD_NONE)
+                return 0;
+        edge = keyword_trie + offset;
 
         while (1) {
-                // check if at the end of table...
-                if (pgm_read_byte (table) == 0)
-                        return position;
-
-                // check for character match...
-                if (text_ptr[pos] == pgm_read_byte (table)) {
-                        pos++;
-                        table++;
+                // the character of the edge matches -- keep the keyword that ends here (if any)
+                ptr++;
+                if (pgm_read_byte (edge + 1) != 0) {
+                        token = pgm_read_byte (edge + 1);
+                        text_ptr = ptr;
+                }
+                // search the edges below for the next character
+                last = edge + 3 + pgm_read_byte (edge + 2);
+                edge += 3;
+                while (edge < last && pgm_read_byte (edge) != *ptr)
+                        edge += 3 + pgm_read_byte (edge + 2);
+                if (edge == last)
+                        return token;
+        }
+}
+
+/** ***************************************************************************
+ * @brief Search for a token of the specified group.
+ *
+ * This function checks whether the current character is one of the tokens
+ * that stand for the keywords of a table (see tokenize()). If it is, the
+ * pointer is moved after the token and any whitespace that follows.
+ *
+ * @note Scanning begins at the character pointed to by @c text_ptr.
+ * @param first The token of the first keyword in the group.
+ * @param count The number of keywords in the group.
+ * @return The position (index) of the keyword, or @c count if not found.
+ *****************************************************************************/
+uint8_t scantoken (uint8_t first, uint8_t count)
+{
+        uint8_t position;
+
+        ignorespace();
+        position = *text_ptr - first;
+        if (position >= count)
+                return count;
+        text_ptr++;
+        ignorespace();
+        return position;
+}
+
+/** ***************************************************************************
+ * @brief Replace keywords with tokens.
+ *
+ * This function copies the line pointed to by @c text_ptr to the specified
+ * location and replaces every keyword (commands, functions, relational
+ * operators, TO and STEP) with a single byte -- a token. Numbers are replaced
+ * with @c TOK_NUM followed by their binary value, unless some information would
+ * be lost (leading zeros or overflow). Strings and comments are copied as they
+ * are, while characters that could be mistaken for tokens are replaced with a
+ * question mark. When done, @c text_ptr points to the
+ * beginning of the tokenized line.
+ *
+ * @note The tokenized line is always placed below the original one.
+ * @param dest The location where the tokenized line will be stored.
+ * @return The length of the tokenized line (including LF).
+ *****************************************************************************/
+uint8_t tokenize (uint8_t *dest)
+{
+        uint8_t *start = dest;
+        uint8_t quote = 0;
+        uint8_t statement = 1;
+        uint8_t index, digits, overflow;
+        uint16_t value;
+
+        while (*text_ptr != LF) {
+                // tokenized line should neither reach the original one nor exceed max length
+                if (dest >= text_ptr) {
+                        error_code = 0x16;
+                        return 0;
+                }
+                if (dest - start >= MAX_LINE_LENGTH) {
+                        error_code = 0x17;
+                        return 0;
+                }
+
+                // strings and spaces are copied as they are
+                if (quote || *text_ptr == SPACE || *text_ptr == TAB) {
+                        if (*text_ptr == quote)
+                                quote = 0;
+                // single quote is a comment at the beginning of statement...
+                } else if (*text_ptr == DQUOTE || (*text_ptr == SQUOTE && !statement)) {
+                        quote = *text_ptr;
+                        statement = 0;
+                } else if (*text_ptr == ':') {
+                        statement = 1;
+                } else if (*text_ptr >= '0' && *text_ptr <= '9') {
+                        statement = 0;
+                        // calculate value of given number
+                        value = 0;
+                        overflow = 0;
+                        for (digits = 0; text_ptr[digits] >= '0' && text_ptr[digits] <= '9'; digits++) {
+                                index = text_ptr[digits] - '0';
+                                if (value > 3276 || (value == 3276 && index > 7))
+                                        overflow = 1;
+                                else
+                                        value = value * 10 + index;
+                        }
+                        // store in binary form if the number can be printed as it was typed
+                        if (!overflow && (digits == 1 || *text_ptr != '0')) {
+                                if (dest + 3 > text_ptr + digits) {
+                                        error_code = 0x16;
+                                        return 0;
+                                }
+                                if (dest - start + 3 > MAX_LINE_LENGTH - 1) {
+                                        error_code = 0x17;
+                                        return 0;
+                                }
+                                dest[0] = TOK_NUM;
+                                *((int16_t *)(dest + 1)) = value;
+                                dest += 3;
+                                text_ptr += digits;
+                                continue;
+                        }
+                        // otherwise, copy all digits but the last one
+                        while (digits > 1) {
+                                *dest++ = *text_ptr++;
+                                digits--;
+                        }
                 } else {
-                        // check if this is the last character of a keyword (add 0x80)
-                        if (text_ptr[pos] + 0x80 == pgm_read_byte (table)) {
-                                text_ptr += pos + 1; // points after the detected keyword
-                                ignorespace();
-                                return position;
+                        statement = 0;
+                        if ((index = scankeyword()) != 0) {
+                                *dest++ = index;
+                                // comments are copied as they are
+                                if (index == TOK_CMD + CMD_REM || index == TOK_CMD + CMD_HASH || index == TOK_CMD + CMD_QUOTE)
+                                        quote = LF;
+                                continue;
                         }
-                        // move to the end of this keyword
-                        while ((pgm_read_byte (table) & 0x80) == 0)
-                                table++;
-                        // move to first character of next keyword
-                        table++;
-                        // increase pointer
-                        position++;
-                        ignorespace();
-                        pos = 0;
                 }
+                // copy current character
+                if (*text_ptr & 0x80)
+                        *dest = '?';
+                else
+                        *dest = *text_ptr;
+                dest++;
+                text_ptr++;
         }
-        return -1;
+        *dest = LF;
+        dest++;
+
+        text_ptr = start;
+        return dest - start;
 }
 
 /** ***************************************************************************
@@ -266,267 +311,333 @@ void parse_notes (void)
 }
 
 /** ***************************************************************************
- * @brief Search for relational operators.
+ * @brief Get the precedence of an operator.
  *
- * This function examines current line and searches for any relational operator.
- *
- * @note Scanning begins at the character pointed to by @c text_ptr.
- * @return The result from the evaluation of the whole expression.
+ * @param op An operator of the stack used by parse_expr().
+ * @return The precedence of the operator (higher binds tighter).
  *****************************************************************************/
-int16_t parse_expr_s1 (void)
+static uint8_t precedence (uint8_t op)
 {
-        int16_t value1, value2;
-        uint8_t index;
-
-        value1 = parse_expr_s2();
-
-        // check for error
-        if (error_code)
-                return value1;
-        index = scantable (relop_table);
-        if (index == RELOP_UNKNOWN)
-                return value1;
-        switch (index) {
-                case RELOP_GE:
-                        value2 = parse_expr_s2();
-                        if (value1 >= value2)
-                                return 1;
-                        break;
-                case RELOP_NE:
-                case RELOP_NE_BANG:
-                        value2 = parse_expr_s2();
-                        if (value1 != value2)
-                                return 1;
-                        break;
-                case RELOP_GT:
-                        value2 = parse_expr_s2();
-                        if (value1 > value2)
-                                return 1;
-                        break;
-                case RELOP_EQ:
-                        value2 = parse_expr_s2();
-                        if (value1 == value2)
-                                return 1;
-                        break;
-                case RELOP_LE:
-                        value2 = parse_expr_s2();
-                        if (value1 <= value2)
-                                return 1;
-                        break;
-                case RELOP_LT:
-                        value2 = parse_expr_s2();
-                        if (value1 < value2)
-                                return 1;
-                        break;
-        }
+        if (op >= OP_RELOP && op < OP_RELOP + RELOP_UNKNOWN)
+                return 1;
+        if (op == OP_ADD || op == OP_SUB)
+                return 2;
+        if (op == OP_MUL || op == OP_DIV)
+                return 3;
+        if (op == OP_NEG)
+                return 4;
+        // parenthesis or function
         return 0;
 }
 
 /** ***************************************************************************
- * @brief Search for subtraction or addition operators.
+ * @brief Append an operand or an operator to the output of parse_expr().
  *
- * This function examines current line and looks for a subtraction
- * or an addition operator.
+ * When evaluating, the operation is performed on the stack of values. When
+ * compiling, the operation is appended to @c expr_code.
  *
- * @note Scanning begins at the character pointed to by @c text_ptr.
- * @return The result from the evaluation of the sub-expression.
+ * @param op The operation (see @c EXPR_OPS enumerator).
+ * @param value The value of a number, the slot of a variable or the index of
+ * a function.
+ * @param values The stack of values.
+ * @param count The number of values in the stack.
+ * @return The number of values in the stack, after the operation.
  *****************************************************************************/
-static int16_t parse_expr_s2 (void)
+static uint8_t output (uint8_t op, int16_t value, int16_t *values, uint8_t count)
 {
-        int16_t value1, value2;
+        // compile expression
+        if (expr_code != NULL) {
+                if (expr_code + 3 > (uint8_t *)line_index) {
+                        error_code = 0x16;
+                        return count;
+                }
+                *expr_code++ = op;
+                if (op == OP_NUM) {
+                        *expr_code++ = value & 0xFF;
+                        *expr_code++ = value >> 8;
+                } else if (op == OP_VAR || op == OP_FN)
+                        *expr_code++ = value;
+                if (op == OP_NUM || op == OP_VAR)
+                        return count + 1;
+                if (op == OP_NEG || op == OP_FN)
+                        return count;
+                return count - 1;
+        }
 
-        if (*text_ptr == '-' || *text_ptr == '+')
-                value1 = 0;
-        else
-                value1 = parse_expr_s3();
-        while (1) {
-                if (*text_ptr == '-') {
-                        text_ptr++;
-                        value2 = parse_expr_s3();
-                        value1 -= value2;
-                } else if (*text_ptr == '+') {
-                        text_ptr++;
-                        value2 = parse_expr_s3();
-                        value1 += value2;
-                } else
-                        return value1;
+        // evaluate expression
+        switch (op) {
+        case OP_NUM:
+                values[count] = value;
+                return count + 1;
+        case OP_VAR:
+                values[count] = ((int16_t *)variables_ptr)[value];
+                return count + 1;
+        case OP_NEG:
+                values[count - 1] = -values[count - 1];
+                return count;
+        case OP_FN:
+                values[count - 1] = call_function (value, values[count - 1]);
+                return count;
         }
+        count--;
+        value = values[count];
+        switch (op) {
+        case OP_ADD:
+                values[count - 1] += value;
+                break;
+        case OP_SUB:
+                values[count - 1] -= value;
+                break;
+        case OP_MUL:
+                values[count - 1] *= value;
+                break;
+        case OP_DIV:
+                if (value == 0)
+                        error_code = 0xB;
+                else
+                        values[count - 1] /= value;
+                break;
+        case OP_RELOP + RELOP_GE:
+                values[count - 1] = values[count - 1] >= value;
+                break;
+        case OP_RELOP + RELOP_NE:
+        case OP_RELOP + RELOP_NE_BANG:
+                values[count - 1] = values[count - 1] != value;
+                break;
+        case OP_RELOP + RELOP_GT:
+                values[count - 1] = values[count - 1] > value;
+                break;
+        case OP_RELOP + RELOP_EQ:
+                values[count - 1] = values[count - 1] == value;
+                break;
+        case OP_RELOP + RELOP_LE:
+                values[count - 1] = values[count - 1] <= value;
+                break;
+        case OP_RELOP + RELOP_LT:
+                values[count - 1] = values[count - 1] < value;
+                break;
+        }
+        return count;
 }
 
 /** ***************************************************************************
- * @brief Search for multiplication or division operators.
+ * @brief Evaluate an expression.
  *
- * This function examines current line and looks for a multiplication
- * or a division operator.
+ * This function examines current line and evaluates the expression found there.
+ * Operators wait in a small stack, until all operators of higher precedence are
+ * applied (shunting-yard algorithm). Both stacks have a fixed size, so the
+ * memory needed does not depend on the expression. An expression that needs
+ * more causes a stack overflow.
  *
- * @note Scanning begins at the character pointed to by @c text_ptr.
- * @return The result from the evaluation of the sub-expression.
+ * @note Scanning begins at the character pointed to by @c text_ptr. If
+ * @c expr_code is set, the expression is not evaluated, but compiled to
+ * reverse polish notation (see bytecode.h).
+ * @return The result from the evaluation of the whole expression.
  *****************************************************************************/
-static int16_t parse_expr_s3 (void)
+int16_t parse_expr (void)
 {
-        int16_t value1, value2;
+        uint8_t ops[EXPR_OPS_SIZE];
+        int16_t values[EXPR_STACK_SIZE];
+        uint8_t op_count = 0;
+        uint8_t value_count = 0;
+        uint8_t op, index;
+        int16_t value;
 
-        value1 = parse_expr_s4();
-
-        ignorespace();
         while (1) {
-                if (*text_ptr == '*') {
+                /////////////////////////////////////////////////////////////////// operands
+                ignorespace();
+                if (op_count == EXPR_OPS_SIZE || value_count == EXPR_STACK_SIZE) {
+                        error_code = 0x3;
+                        return 0;
+                }
+                // plus sign -- changes nothing
+                if (*text_ptr == '+') {
+                        text_ptr++;
+                        continue;
+                }
+                // minus sign
+                if (*text_ptr == '-') {
+                        text_ptr++;
+                        ops[op_count++] = OP_NEG;
+                        continue;
+                }
+                // expression in parenthesis
+                if (*text_ptr == '(') {
                         text_ptr++;
-                        value2 = parse_expr_s4();
-                        value1 *= value2;
-                } else if (*text_ptr == '/') {
+                        ops[op_count++] = EXPR_PAREN;
+                        continue;
+                }
+                // number in binary form (see tokenize())
+                if (*text_ptr == TOK_NUM) {
+                        value_count = output (OP_NUM, *((int16_t *)(text_ptr + 1)), values, value_count);
+                        text_ptr += 3;
+                // leading zeros are not allowed
+                } else if (*text_ptr == '0') {
                         text_ptr++;
-                        value2 = parse_expr_s4();
-                        if (value2 != 0)
-                                value1 /= value2;
+                        value_count = output (OP_NUM, 0, values, value_count);
+                // calculate value of given number
+                } else if (*text_ptr >= '1' && *text_ptr <= '9') {
+                        value = 0;
+                        do {
+                                value = value * 10 + *text_ptr - '0';
+                                text_ptr++;
+                        } while (*text_ptr >= '0' && *text_ptr <= '9');
+                        value_count = output (OP_NUM, value, values, value_count);
+                // variables -- names are single letters
+                } else if (text_ptr[0] >= 'A' && text_ptr[0] <= 'Z') {
+                        if (text_ptr[1] >= 'A' && text_ptr[1] <= 'Z') {
+                                error_code = 0xE;
+                                return 0;
+                        }
+                        value_count = output (OP_VAR, *text_ptr - 'A', values, value_count);
+                        text_ptr++;
+                } else {
+                        // functions
+                        index = scantoken (TOK_FN, FN_UNKNOWN);
+                        if (index == FN_UNKNOWN) {
+                                error_code = 0x15;
+                                return 0;
+                        }
+                        // check for left parenthesis
+                        if (*text_ptr != '(') {
+                                error_code = 0x5;
+                                return 0;
+                        }
+                        text_ptr++;
+                        ops[op_count++] = EXPR_FUNCTION + index;
+                        continue;
+                }
+
+                /////////////////////////////////////////////////////////////////// operators
+                while (1) {
+                        if (error_code)
+                                return 0;
+                        ignorespace();
+                        if (*text_ptr == '+')
+                                op = OP_ADD;
+                        else if (*text_ptr == '-')
+                                op = OP_SUB;
+                        else if (*text_ptr == '*')
+                                op = OP_MUL;
+                        else if (*text_ptr == '/')
+                                op = OP_DIV;
+                        else if (*text_ptr >= TOK_RELOP && *text_ptr < TOK_RELOP + RELOP_UNKNOWN)
+                                op = OP_RELOP + *text_ptr - TOK_RELOP;
                         else
-                                error_code = 0xB;
-                } else
-                        return value1;
+                                op = EXPR_PAREN;
+
+                        // apply pending operators of higher (or same) precedence
+                        while (op_count > 0 && precedence (ops[op_count - 1]) >= precedence (op) && precedence (ops[op_count - 1]) > 0)
+                                value_count = output (ops[--op_count], 0, values, value_count);
+
+                        // binary operator --> wait for second operand
+                        if (op != EXPR_PAREN) {
+                                text_ptr++;
+                                ops[op_count++] = op;
+                                break;
+                        }
+
+                        // end of expression
+                        if (op_count == 0) {
+                                if (error_code)
+                                        return 0;
+                                if (expr_code != NULL)
+                                        return 0;
+                                return values[0];
+                        }
+
+                        // end of parenthesis or function parameter
+                        if (*text_ptr != ')') {
+                                error_code = 0x6;
+                                return 0;
+                        }
+                        text_ptr++;
+                        op = ops[--op_count];
+                        if (op != EXPR_PAREN)
+                                value_count = output (OP_FN, op - EXPR_FUNCTION, values, value_count);
+                }
         }
 }
 
 /** ***************************************************************************
- * @brief Search for numbers, variables or functions.
+ * @brief Evaluate a function.
  *
- * This function examines current line and looks for string representations
- * of numbers, variables and functions.
+ * This function calculates the value of a function for the given argument.
+ * It is used by the expression parser and by the bytecode engine.
  *
- * @note Scanning begins at the character pointed to by @c text_ptr.
- * @return The result from the evaluation of the sub-expression.
+ * @param index The function (see the enumerator of functions).
+ * @param value1 The argument of the function.
+ * @return The value of the function.
  *****************************************************************************/
-static int16_t parse_expr_s4 (void)
+int16_t call_function (uint8_t index, int16_t value1)
 {
-        uint8_t index;
-        int16_t value1 = 0;
-        int16_t value2 = 0;
+        int16_t value2;
 
-        /////////////////////////////////////////////////////////////////////////// numbers
-        ignorespace();
-        // check for minus sign
-        if (*text_ptr == '-') {
-                text_ptr++;
-                return -parse_expr_s4();
-        }
-        // leading zeros are not allowed
-        if (*text_ptr == '0') {
-                text_ptr++;
-                return 0;
-        }
-        // calculate value of given number
-        if (*text_ptr >= '1' && *text_ptr <= '9') {
-                do {
-                        value1 = value1 * 10 + *text_ptr - '0';
-                        text_ptr++;
-                } while (*text_ptr >= '0' && *text_ptr <= '9');
-                return value1;
-        }
-
-        /////////////////////////////////////////////////////////////////////////// variables
-        if (text_ptr[0] >= 'A' && text_ptr[0] <= 'Z') {
-                // check next character -- variable names are single letters
-                if (text_ptr[1] < 'A' || text_ptr[1] > 'Z') {
-                        // return a pointer to the referenced variable
-                        value2 = ((int16_t *)variables_ptr)[*text_ptr - 'A'];
-                        text_ptr++;
-                        return value2;
-                }
-                /////////////////////////////////////////////////////////////////////////// functions
-                // search table with function names
-                index = scantable (functions);
-                if (index == FN_UNKNOWN) {
-                        error_code = 0xE;
+        switch (index) {
+        //-----------------------------------------------------------------
+        case FN_PEEK:
+                if (value1 > MEMORY_SIZE) {
+                        error_code = 0x13;
                         return 0;
                 }
-                // check for left parenthesis
-                if (*text_ptr != '(') {
-                        error_code = 0x5;
+                return program_space[value1];
+        //-----------------------------------------------------------------
+        case FN_ABS:
+                if (value1 < 0)
+                        return -value1;
+                return value1;
+        //-----------------------------------------------------------------
+        case FN_RND:
+                return rand() % value1;
+        //-----------------------------------------------------------------
+        case FN_PINDREAD:
+                // expected a pin number (0..7)
+                if (value1 < 0 || value1 > 7) {
+                        error_code = 0xC;
                         return 0;
                 }
-                text_ptr++;
-                // get parameter
-                value1 = parse_expr_s1();
-                // check for right parenthesis
-                if (*text_ptr != ')') {
-                        error_code = 0x6;
+                // create bit mask for following checks
+                value1 = 1 << value1;
+                // selected pin should be configured as input
+                if (sec_data_bus_dir & value1) {
+                        error_code = 0xD;
                         return 0;
                 }
-                text_ptr++;
-                switch (index) {
-                //-----------------------------------------------------------------
-                case FN_PEEK:
-                        if (value1 > MEMORY_SIZE) {
-                                error_code = 0x13;
-                                return 0;
-                        }
-                        return program_space[value1];
-                //-----------------------------------------------------------------
-                case FN_ABS:
-                        if (value1 < 0)
-                return -value1;
-                        return value1;
-                //-----------------------------------------------------------------
-                case FN_RND:
-                        return rand() % value1;
-                //-----------------------------------------------------------------
-                case FN_PINDREAD:
-                        // expected a pin number (0..7)
-                        if (value1 < 0 || value1 > 7) {
-                                error_code = 0xC;
-                                return 0;
-                        }
-                        // create bit mask for following checks
-                        value1 = 1 << value1;
-                        // selected pin should be configured as input
-                        if (sec_data_bus_dir & value1) {
-                                error_code = 0xD;
-                                return 0;
-                        }
-                        // get the digital value
-                        if (sec_data_bus_in & value1)
-                return 1;
+                // get the digital value
+                if (sec_data_bus_in & value1)
+                        return 1;
+                return 0;
+        //-----------------------------------------------------------------
+        case FN_PINAREAD:
+                // expected a pin number (0..7)
+                if (value1 < 0 || value1 > 7) {
+                        error_code = 0xC;
                         return 0;
-                //-----------------------------------------------------------------
-                case FN_PINAREAD:
-                        // expected a pin number (0..7)
-                        if (value1 < 0 || value1 > 7) {
-                                error_code = 0xC;
-                                return 0;
-                        }
-                        // enable specified input channel
-                        ADMUX = value1;
-                        // create bit mask for following checks
-                        value1 = 1 << value1;
-                        // disable pull-up on selected pin
-                        value2 = sec_data_bus_out;
-                        sec_data_bus_out &= ~value1;
-                        // selected pin should be configured as input
-                        if (sec_data_bus_dir & value1) {
-                                error_code = 0xD;
-                                return 0;
-                        }
-                        // get the analog value
-                        ADCSRA |= _BV (ADSC);
-                        while (ADCSRA & _BV (ADSC));
-                        // restore state of pull-up
-                        sec_data_bus_out = value2;
-                        return ADCW >> 1;
                 }
-        }
-// ------------------------------------------------------------------- expression in parenthesis
-        if (*text_ptr == '(') {
-                text_ptr++;
-                value1 = parse_expr_s1();
-                if (*text_ptr != ')') {
-                        error_code = 0x6;
+                // enable specified input channel
+                ADMUX = value1;
+                // create bit mask for following checks
+                value1 = 1 << value1;
+                // disable pull-up on selected pin
+                value2 = sec_data_bus_out;
+                sec_data_bus_out &= ~value1;
+                // selected pin should be configured as input
+                if (sec_data_bus_dir & value1) {
+                        error_code = 0xD;
                         return 0;
                 }
-                text_ptr++;
-                return value1;
+                // get the analog value
+                ADCSRA |= _BV (ADSC);
+                while (ADCSRA & _BV (ADSC));
+                // restore state of pull-up
+                sec_data_bus_out = value2;
+                return ADCW >> 1;
+        //-----------------------------------------------------------------
+        case FN_EBUSY:
+                // bytes not yet written to EEPROM (the argument is ignored)
+                return rom_pending();
         }
-    /* SOME APPROPRIATE ERROR CODE */
-    error_code = 0x15;
-    return 0;
+        return 0;
 }
 
 /** ***************************************************************************
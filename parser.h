@@ -3,10 +3,20 @@
  * @brief Enumerators for the supported commands and functions and some prototypes.
  *
  * The @c COMMANDS enumerator contains a member for each command supported by the language.
- * The memebers of the enumerator appear in the same order as the corresponding commands, in the
- * @c commands table (see parser.c). The last member of the enumerator is used for assignments
+ * It is generated (along with the enumerators of functions and relational operators and the
+ * keyword tables) from keywords.def, so the members always appear in the same order as the
+ * corresponding keywords. The last member of the enumerator is used for assignments
  * (some_variable = some_value) which do not use some special command. I other words, CMD_UNKNOWN
- * corresponds to no entry in \c commands table.
+ * corresponds to no keyword.
+ *
+ * Stored lines do not contain keywords, but tokens. The token of every keyword is calculated
+ * from its position in keywords.def, so the enumerators also determine the tokens.
+ * Numbers are stored in binary form: @c TOK_NUM followed by the 16bit value.
+ * When a program runs, constant GOTO/GOSUB targets become @c TOK_LINK followed by the
+ * offset of the target line in program memory (see link_program()).
+ *
+ * The @c EXPR_OPS enumerator contains the operations of an expression, in the order they are
+ * applied by parse_expr(). The same operations form the expressions of compiled programs.
  */
 
 #ifndef PARSER_H
@@ -18,90 +28,69 @@
 
 #include "main.h"
 #include "interpreter.h"
+#include "keywords.h"
 
 // ------------------------------------------------------------------------------
 // PROTOTYPES
 // ------------------------------------------------------------------------------
 
-int8_t scantable (const uint8_t *table);
+uint8_t scankeyword (void);
+uint8_t scantoken (uint8_t first, uint8_t count);
+uint8_t tokenize (uint8_t *dest);
 void parse_channel (void);
 void parse_notes (void);
-int16_t parse_expr_s1 (void);
+int16_t parse_expr (void);
+int16_t call_function (uint8_t index, int16_t value1);
 
 // ------------------------------------------------------------------------------
 // ENUMERATORS
 // ------------------------------------------------------------------------------
 
-enum COMMANDS {
-        CMD_LIST = 0,
-        CMD_NEW,
-        CMD_RUN,
-        CMD_NEXT,
-        CMD_LET,
-        CMD_IF,
-        CMD_GOTO,
-        CMD_MPLAY,
-        CMD_MSTOP,
-        CMD_TEMPO,
-        CMD_MUSIC,
-        CMD_GOSUB,
-        CMD_RETURN,
-        CMD_RANDOMIZE,
-        CMD_RNDSEED,
-        CMD_RST,
-        CMD_CLS,
-        CMD_REM,
-        CMD_FOR,
-        CMD_INPUT,
-        CMD_BEEP,
-        CMD_PRINT,
-        CMD_LOCATE,
-        CMD_POKE,
-        CMD_PSET,
-        CMD_STOP,
-        CMD_END,
-        CMD_MEM,
-        CMD_PEN,
-        CMD_PAPER,
-        CMD_QMARK,
-        CMD_HASH,
-        CMD_QUOTE,
-        CMD_DELAY,
-        CMD_ELIST,
-        CMD_EFORMAT,
-        CMD_ECHAIN,
-        CMD_ESAVE,
-        CMD_ELOAD,
-        CMD_SSAVE,
-        CMD_SLOAD,
-        CMD_FILES,
-        CMD_CFORMAT,
-        CMD_CCHAIN,
-        CMD_CSAVE,
-        CMD_CLOAD,
-        CMD_PINDIR,
-        CMD_PINDWRITE,
-        CMD_UNKNOWN
+enum EXPR_OPS {
+        OP_NUM = 0,             // 16bit value
+        OP_VAR,                 // variable slot
+        OP_ADD,
+        OP_SUB,
+        OP_MUL,
+        OP_DIV,
+        OP_NEG,
+        OP_FN,                  // function index
+        OP_RELOP                // relational operators (one per RELOP_xx)
 };
 
-enum {
-        FN_PEEK = 0,
-        FN_ABS,
-        FN_RND,
-        FN_PINDREAD,
-        FN_PINAREAD,
-        FN_UNKNOWN
-};
+// ------------------------------------------------------------------------------
+// MACROS
+// ------------------------------------------------------------------------------
 
-enum OPERATORS {
-        RELOP_GE = 0,
-        RELOP_NE,
-        RELOP_GT,
-        RELOP_EQ,
-        RELOP_LE,
-        RELOP_LT,
-        RELOP_NE_BANG,
-        RELOP_UNKNOWN
-};
+/** The depth of the stack of values used for the evaluation of expressions. */
+#define EXPR_STACK_SIZE 16
+/** The depth of the stack of operators (each parenthesis takes one more entry). */
+#define EXPR_OPS_SIZE   32
+/** Marks a parenthesis in the stack of operators. */
+#define EXPR_PAREN      0x7F
+/** Marks a function in the stack of operators (plus the index of the function). */
+#define EXPR_FUNCTION   0x80
+
+// ------------------------------------------------------------------------------
+// GLOBALS
+// ------------------------------------------------------------------------------
+
+/** Where parse_expr() places the compiled expression (NULL to evaluate it). */
+uint8_t *expr_code;
+
+// ------------------------------------------------------------------------------
+// TOKENS
+// ------------------------------------------------------------------------------
+
+#define TOK_CMD         0x80
+#define TOK_FN          (TOK_CMD + CMD_UNKNOWN)
+#define TOK_RELOP       (TOK_FN + FN_UNKNOWN)
+#define TOK_TO          (TOK_RELOP + RELOP_UNKNOWN)
+#define TOK_STEP        (TOK_TO + 1)
+#define TOK_NUM         (TOK_STEP + 1)
+#define TOK_LINK        (TOK_NUM + 1)
+#define TOK_LAST        TOK_LINK
+
+#define TOK_EQ          (TOK_RELOP + RELOP_EQ)
 
 #endif
@@ -37,6 +37,12 @@ const uint8_t msg_welcome[25]   PROGMEM = "Welcome to nstBASIC v0.2\0";
 const uint8_t msg_ram_bytes[11] PROGMEM = " bytes RAM\0";
 const uint8_t msg_rom_bytes[11] PROGMEM = " bytes ROM\0";
 const uint8_t msg_available[17] PROGMEM = " bytes available\0";
+const uint8_t msg_listing[8]   PROGMEM = " (text)\0";
+const uint8_t msg_bytes[7]      PROGMEM = " bytes\0";
+const uint8_t msg_packed[9]     PROGMEM = " packed)\0";
+const uint8_t msg_stored[14]    PROGMEM = " bytes stored\0";
+const uint8_t msg_buffered[23]  PROGMEM = " serial bytes buffered\0";
+const uint8_t msg_lost[7]       PROGMEM = " lost)\0";
 const uint8_t msg_break[7]      PROGMEM = "Break!\0";
 const uint8_t msg_ok[3]         PROGMEM = "OK\0";
 
@@ -63,6 +69,13 @@ const uint8_t err_msg12[23] PROGMEM = "Expected byte [0..255]\0";
 const uint8_t err_msg13[13] PROGMEM = "Out of range\0";
 const uint8_t err_msg14[24] PROGMEM = "Expected color [0..127]\0";
 const uint8_t err_msg15[21] PROGMEM = "Expression expected!\0";
+const uint8_t err_msg16[18] PROGMEM = "Not enough memory\0";
+const uint8_t err_msg17[14] PROGMEM = "Line too long\0";
+const uint8_t err_msg18[18] PROGMEM = "Only in programs\0";
+const uint8_t err_msg19[14] PROGMEM = "Invalid image\0";
+const uint8_t err_msg1A[18] PROGMEM = "Invalid file name\0";
+const uint8_t err_msg1B[15] PROGMEM = "File not found\0";
+const uint8_t err_msg1C[16] PROGMEM = "Transfer failed\0";
 
 // keyboard connectivity messages
 const uint8_t kb_fail_msg[26] PROGMEM = "Keyboard self-test failed\0";
@@ -122,10 +135,52 @@ void printmsg (const uint8_t *message, FILE *stream)
         newline (stream);
 }
 
+/** ***************************************************************************
+ * @brief Print the keyword that corresponds to specified token
+ *****************************************************************************/
+static void printkeyword (uint8_t token, FILE *stream)
+{
+        const uint8_t *table;
+
+        // find the table that contains the keyword
+        if (token < TOK_FN) {
+                table = commands;
+                token -= TOK_CMD;
+        } else if (token < TOK_RELOP) {
+                table = functions;
+                token -= TOK_FN;
+        } else if (token < TOK_TO) {
+                table = relop_table;
+                token -= TOK_RELOP;
+        } else if (token == TOK_TO) {
+                table = to_tab;
+                token = 0;
+        } else {
+                table = step_tab;
+                token = 0;
+        }
+
+        // skip previous keywords
+        while (token > 0) {
+                if (pgm_read_byte (table) & 0x80)
+                        token--;
+                table++;
+        }
+
+        // print keyword (last character is marked with 0x80)
+        while ((pgm_read_byte (table) & 0x80) == 0)
+                fputc (pgm_read_byte (table++), stream);
+        fputc (pgm_read_byte (table) & 0x7F, stream);
+}
+
 /** ***************************************************************************
  * @brief Print a program line
+ *
+ * Tokens are replaced with the respective keywords and numbers stored in
+ * binary form are printed in decimal. If a mark is specified, a caret is
+ * printed in front of the character it points to.
  *****************************************************************************/
-void printline (uint8_t *line, FILE *stream)
+void printline (uint8_t *line, uint8_t *mark, FILE *stream)
 {
         LINE_NUMBER line_num = *((LINE_NUMBER *)(line));
 
@@ -136,11 +191,28 @@ void printline (uint8_t *line, FILE *stream)
         fputc (' ', stream);
 
         // print line content
-        while (*line != LF) {
-                fputc (*line, stream);
+        while (1) {
+                if (line == mark)
+                        fputc ('^', stream);
+                if (*line == LF)
+                        break;
+                if (*line == TOK_NUM) {
+                        printnum (*((int16_t *)(line + 1)), stream);
+                        line += 3;
+                        continue;
+                }
+                // linked GOTO/GOSUB target --> print number of target line
+                if (*line == TOK_LINK) {
+                        printnum (*((LINE_NUMBER *)(program_space + *((uint16_t *)(line + 1)))), stream);
+                        line += 3;
+                        continue;
+                }
+                if (*line >= TOK_CMD)
+                        printkeyword (*line, stream);
+                else
+                        fputc (*line, stream);
                 line++;
         }
-        line++;
         newline (stream);
 }
 
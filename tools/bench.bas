@@ -0,0 +1,9 @@
+10 S=0
+20 FOR I=1 TO 300
+30 FOR J=1 TO 1000
+40 S=S+I*3-J/7
+50 IF S>10000 S=S-10000
+60 NEXT J
+70 NEXT I
+80 PRINT S
+90 END
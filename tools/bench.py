@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+#
+# Time programs on nstBASIC, with and without bytecode.
+#
+# Copyright 2016, Panagiotis Varelas <varelaspanos@gmail.com>
+#
+# nstBASIC is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# nstBASIC is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+
+"""
+Time a program on nstBASIC, linked to the host with HOST (see hostlink.py).
+
+usage: bench.py [-b BAUD] [-c CLOCK] [-r RUNS] [-t SECONDS] PORT [FILE]
+
+HOST must be running on nstBASIC (type HOST first, the link is left open).
+The program (tools/bench.bas by default) is loaded and RUN after COMPILE 1, so
+that it is compiled to bytecode (if nstBASIC was built with BYTECODE), and
+after COMPILE 0, so that the text interpreter runs it. Both must print the
+same; COMPILE 1 is left selected. The time of a program that does nothing is
+taken off what RUN takes (the frames of the link), the fastest of RUNS runs is
+kept and it is printed in seconds and in cycles of the clock (F_CPU).
+"""
+
+import argparse
+import os
+import sys
+import time
+
+from hostlink import Link, LinkError
+from xmodem import Port
+
+CLOCK = 20000000
+
+
+def timed_run(link, listing, compiled, runs, timeout):
+    """Load a program and RUN it (compiled or not); return the fastest time (seconds) and the output."""
+    for text in ['COMPILE %d' % compiled, 'NEW'] + listing:
+        code, _, _ = link.request(text)
+        if code != 0:
+            raise LinkError('loading %s: error 0x%02X' % (text, code))
+    best, output = None, None
+    for _ in range(runs):
+        lines = []
+        start = time.monotonic()
+        code, where, problem = link.request('RUN', timeout=timeout, output=lines)
+        elapsed = time.monotonic() - start
+        if code != 0 or problem:
+            raise LinkError('error 0x%02X in line %d%s' % (code, where, ' (%s)' % problem if problem else ''))
+        if output is not None and lines != output:
+            raise LinkError('the output differs between runs')
+        output = lines
+        best = elapsed if best is None else min(best, elapsed)
+    return best, output
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Time a program on nstBASIC, with and without bytecode.')
+    parser.add_argument('-b', '--baud', type=int, help='serial rate (as selected by BAUD)')
+    parser.add_argument('-c', '--clock', type=int, default=CLOCK, help='clock of the microcontroller (F_CPU)')
+    parser.add_argument('-r', '--runs', type=int, default=3, help='number of runs (the fastest is kept)')
+    parser.add_argument('-t', '--time', type=float, default=600, help='time limit of every run (seconds)')
+    parser.add_argument('port')
+    parser.add_argument('file', nargs='?', default=os.path.join(os.path.dirname(__file__), 'bench.bas'))
+    args = parser.parse_args()
+
+    with open(args.file) as f:
+        listing = [text.rstrip('\r\n') for text in f if text.strip()]
+
+    port = Port(args.port, args.baud)
+    link = Link(port)
+    try:
+        empty, _ = timed_run(link, ['10 END'], 1, args.runs, args.time)
+        compiled, output = timed_run(link, listing, 1, args.runs, args.time)
+        text, expected = timed_run(link, listing, 0, args.runs, args.time)
+        link.request('COMPILE 1')
+        link.request('NEW')
+    except LinkError as error:
+        sys.exit('bench: %s' % error)
+    finally:
+        port.close()
+    if output != expected:
+        sys.exit('bench: the output of bytecode and of the text interpreter differs')
+
+    print('%s (%d runs, %.3f s of link overhead taken off)' % (args.file, args.runs, empty))
+    for name, seconds in (('bytecode', compiled), ('text', text)):
+        seconds = max(seconds - empty, 0)
+        print('%-10s %10.3f s %14d cycles' % (name, seconds, seconds * args.clock))
+    if compiled > empty:
+        print('speed-up   %10.2fx' % ((text - empty) / (compiled - empty)))
+
+
+if __name__ == '__main__':
+    main()
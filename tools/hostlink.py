@@ -0,0 +1,190 @@
+#!/usr/bin/env python3
+#
+# Run programs on nstBASIC from a host, over the serial port.
+#
+# Copyright 2016, Panagiotis Varelas <varelaspanos@gmail.com>
+#
+# nstBASIC is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# nstBASIC is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+
+"""
+Run programs on nstBASIC, linked to the host with HOST.
+
+usage: hostlink.py [-b BAUD] [-t SECONDS] [-i VALUE]... [-q] PORT FILE...
+
+Every FILE (a listing) is loaded (NEW, then line by line) and RUN. INPUT gets
+the values given with -i, in order (every program starts from the first one).
+The output of every program is printed, followed by its outcome on stderr. A
+program that runs for longer than the time limit is stopped (CTRL+C). The exit
+status is 0 if every program has ended without error. With -q, the link ends
+afterwards and the keyboard is the console again.
+
+Both sides send frames, one per line: ':', the type of the frame, its text and
+the CRC-16 of the type and the text (four hex digits). The host sends lines
+(L), values for INPUT (V) and asks to end the link (Q). nstBASIC sends lines of
+output (O), requests for a value (I), the outcome of every line (S: the error
+code in hex, followed by the line number of a program line that failed) and
+refuses damaged frames (N), which are sent again. Records from nstBASIC are not
+sent again: a damaged one fails the program. The module can be imported by
+other test scripts (see Link).
+"""
+
+import argparse
+import sys
+import time
+
+from xmodem import Port, crc16
+
+ETX = 0x03
+LF = 0x0A
+CR = 0x0D
+XON = 0x11
+XOFF = 0x13
+
+RETRIES = 10
+# seconds to wait for the outcome of a line (but RUN)
+REPLY_TIMEOUT = 10
+
+
+class LinkError(Exception):
+    pass
+
+
+class Link:
+    """The host end of HOST."""
+
+    def __init__(self, port):
+        self.port = port
+
+    def frame(self, kind, text=''):
+        body = (kind + text).encode('ascii')
+        self.port.write(b':' + body + b'%04X\n' % crc16(body))
+
+    def record(self, timeout):
+        """Return the next record as (type, text), or None if nothing arrives in time."""
+        deadline = time.monotonic() + timeout
+        line = bytearray()
+        while True:
+            left = deadline - time.monotonic()
+            byte = self.port.read(left) if left > 0 else None
+            if byte is None:
+                return None
+            # flow control (sent ahead of everything else) and noise between records
+            if byte in (XON, XOFF, CR):
+                continue
+            if byte != LF:
+                line.append(byte)
+                continue
+            start = line.rfind(b':')
+            if start >= 0:
+                break
+            line.clear()
+        body, crc = bytes(line[start + 1:-4]), bytes(line[start + 1:][-4:])
+        if not body or b'%04X' % crc16(body) != crc:
+            raise LinkError('damaged record: %r' % bytes(line[start:]))
+        return chr(body[0]), body[1:].decode('ascii', 'replace')
+
+    def request(self, text, inputs=(), timeout=REPLY_TIMEOUT, output=None):
+        """
+        Send a line, as if typed; return its outcome as (error code, line number,
+        problem). Lines of output are appended to output (or printed) and INPUT
+        gets the values of inputs. Once the time limit is over, or INPUT asks for
+        more values, CTRL+C stops the program and problem says so.
+        """
+        inputs = list(inputs)
+        last = ('L', text)
+        tries = 0
+        problem = None
+        self.frame(*last)
+        while True:
+            reply = self.record(timeout)
+            if reply is None:
+                if problem is not None:
+                    raise LinkError('no reply')
+                problem = 'time limit'
+                self.port.write(bytes([ETX]))
+                timeout = REPLY_TIMEOUT
+                continue
+            kind, text = reply
+            if kind == 'O':
+                if output is None:
+                    print(text)
+                else:
+                    output.append(text)
+            elif kind == 'I':
+                if not inputs:
+                    problem = 'no more values for INPUT'
+                    self.port.write(bytes([ETX]))
+                    continue
+                last = ('V', inputs.pop(0))
+                self.frame(*last)
+            elif kind == 'N':
+                tries += 1
+                if tries == RETRIES:
+                    raise LinkError('frame refused')
+                self.frame(*last)
+            elif kind == 'S':
+                code, _, where = text.partition(' ')
+                return int(code, 16), int(where or 0), problem
+
+    def run(self, listing, inputs=(), timeout=60, output=None):
+        """Load a program and RUN it; return its outcome (see request())."""
+        for text in ['NEW'] + list(listing):
+            code, where, problem = self.request(text)
+            if code != 0:
+                return code, where, 'loading ' + text
+        return self.request('RUN', inputs, timeout, output)
+
+    def quit(self):
+        self.frame('Q')
+        while self.record(REPLY_TIMEOUT) not in (None, ('S', '00')):
+            pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Run programs on nstBASIC over the serial port.')
+    parser.add_argument('-b', '--baud', type=int, help='serial rate (as selected by BAUD)')
+    parser.add_argument('-t', '--time', type=float, default=60, help='time limit of every program (seconds)')
+    parser.add_argument('-i', '--input', action='append', default=[], help='a value for INPUT')
+    parser.add_argument('-q', '--quit', action='store_true', help='end the link afterwards')
+    parser.add_argument('port')
+    parser.add_argument('files', nargs='+')
+    args = parser.parse_args()
+
+    port = Port(args.port, args.baud)
+    link = Link(port)
+    failed = 0
+    try:
+        for path in args.files:
+            with open(path) as f:
+                listing = [text.rstrip('\r\n') for text in f if text.strip()]
+            code, where, problem = link.run(listing, args.input, args.time)
+            outcome = 'ok' if code == 0 else 'error 0x%02X' % code
+            if where:
+                outcome += ' in line %d' % where
+            if problem:
+                outcome += ' (%s)' % problem
+            print('%s: %s' % (path, outcome), file=sys.stderr)
+            if code != 0 or problem:
+                failed += 1
+        if args.quit:
+            link.quit()
+    except LinkError as error:
+        sys.exit('hostlink: %s' % error)
+    finally:
+        port.close()
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,318 @@
+#!/usr/bin/env python3
+#
+# Keyword table generator for nstBASIC.
+#
+# Copyright 2016, Panagiotis Varelas <varelaspanos@gmail.com>
+#
+# nstBASIC is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# nstBASIC is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+
+"""
+Generate the keyword tables of nstBASIC from a keyword specification.
+
+usage: keywords.py [--check] keywords.def
+
+Two files are created next to the specification (same name, .h and .c):
+- the header holds the enumerators of every group of keywords and the
+  declarations of the tables,
+- the source holds the keyword tables used for printing (one per group) and
+  a trie used by tokenize(), indexed by the first character of the keywords.
+
+Every edge of the trie takes three bytes: the character, the token of the
+keyword that ends there (0 if none) and the size of the edges below it. The
+edges below an edge follow it immediately.
+
+With --check, nothing is created: every keyword, every prefix of a keyword
+and every keyword followed by another character is looked up in the trie, the
+way tokenize() walks it, and in the keyword tables, the way they were searched
+before the trie (in order, the first keyword that matches wins). Both must
+find the same keyword.
+"""
+
+import os
+import sys
+
+# group: (enumerator, prefix of members, table, token, comment)
+GROUPS = {
+    'CMD':   ('COMMANDS',  'CMD_',   'commands',    'TOK_CMD + CMD_',
+              'functions which cannot be part of a larger expression (return nothing / might print a value)'),
+    'FN':    ('FUNCTIONS', 'FN_',    'functions',   'TOK_FN + FN_',
+              'functions that must be part of a larger expression (return a value / print nothing)'),
+    'RELOP': ('OPERATORS', 'RELOP_', 'relop_table', 'TOK_RELOP + RELOP_',
+              'relational operators'),
+    'TO':    (None,        None,     'to_tab',      'TOK_TO',
+              'other keywords'),
+    'STEP':  (None,        None,     'step_tab',    'TOK_STEP',
+              None),
+}
+ORDER = ['CMD', 'FN', 'RELOP', 'TO', 'STEP']
+
+FIRST_CHAR = 0x21
+LAST_CHAR = 0x5A
+
+
+def fail(path, number, message):
+    sys.exit('%s:%d: %s' % (path, number, message))
+
+
+def read_spec(path):
+    """Return the keywords as (group, name, keyword) tuples, in file order."""
+    keywords = []
+    group_index = 0
+    with open(path) as spec:
+        for number, line in enumerate(spec, 1):
+            fields = line.split()
+            if not fields or line.startswith('#'):
+                continue
+            if len(fields) != 3:
+                fail(path, number, 'expected: group name keyword')
+            group, name, keyword = fields
+            if group not in GROUPS:
+                fail(path, number, 'unknown group ' + group)
+            if ORDER.index(group) < group_index:
+                fail(path, number, 'groups must appear in this order: ' + ', '.join(ORDER))
+            group_index = ORDER.index(group)
+            if any(ord(c) < FIRST_CHAR or ord(c) > LAST_CHAR for c in keyword):
+                fail(path, number, 'keywords consist of upper-case letters and symbols')
+            if any(k[2] == keyword for k in keywords):
+                fail(path, number, 'duplicate keyword ' + keyword)
+            keywords.append((group, name, keyword))
+    for group in ('TO', 'STEP'):
+        if sum(1 for k in keywords if k[0] == group) != 1:
+            sys.exit('%s: exactly one %s keyword is expected' % (path, group))
+    return keywords
+
+
+def char_literal(c):
+    return "'\\''" if c == "'" else "'%s'" % c
+
+
+def token_of(keyword):
+    group, name, _ = keyword
+    token = GROUPS[group][3]
+    return token + name if token.endswith('_') else token
+
+
+def build_trie(keywords):
+    """
+    Build the trie: every node is a dictionary of its edges (character -> node)
+    plus the token of the keyword that ends there. When more than one keyword
+    matches, the one that appears first in the specification wins. The lookup
+    keeps the deepest token it finds along the way, so a keyword is stored only
+    if it comes before every shorter keyword that is a prefix of it.
+    """
+    root = {'edges': {}, 'token': None, 'order': None}
+    for order, keyword in enumerate(keywords):
+        node = root
+        for c in keyword[2]:
+            node = node['edges'].setdefault(c, {'edges': {}, 'token': None, 'order': None})
+        node['token'] = token_of(keyword)
+        node['order'] = order
+
+    def prune(node, best):
+        if node['order'] is not None:
+            if best is not None and best < node['order']:
+                node['token'] = None
+            else:
+                best = node['order']
+        for child in node['edges'].values():
+            prune(child, best)
+    prune(root, None)
+    return root
+
+
+def emit_edges(node, prefix, lines):
+    """Append the edges below a node to lines; return their size in bytes."""
+    size = 0
+    for c in sorted(node['edges']):
+        child = node['edges'][c]
+        entry = len(lines)
+        lines.append(None)
+        below = emit_edges(child, prefix + c, lines)
+        if below > 255:
+            sys.exit('keywords beginning with %s take too much space' % (prefix + c))
+        lines[entry] = (prefix + c, char_literal(c), child['token'] or '0', below)
+        size += 3 + below
+    return size
+
+
+def write_header(path, base, keywords, groups):
+    guard = base.upper() + '_H'
+    out = []
+    out.append('/* Generated by tools/keywords.py from %s.def -- do not edit. */' % base)
+    out.append('')
+    out.append('#ifndef %s' % guard)
+    out.append('#define %s' % guard)
+    out.append('')
+    out.append('#include <stdint.h>')
+    out.append('')
+    for group in ORDER:
+        enum, prefix = GROUPS[group][0], GROUPS[group][1]
+        if enum is None:
+            continue
+        out.append('enum %s {' % enum)
+        for i, keyword in enumerate(groups[group]):
+            out.append('        %s%s%s,' % (prefix, keyword[1], ' = 0' if i == 0 else ''))
+        out.append('        %sUNKNOWN' % prefix)
+        out.append('};')
+        out.append('')
+    out.append('/** The range of characters a keyword may begin with. */')
+    out.append('#define KEYWORD_FIRST   %s' % char_literal(chr(FIRST_CHAR)))
+    out.append('#define KEYWORD_LAST    %s' % char_literal(chr(LAST_CHAR)))
+    out.append('/** No keyword begins with the character. */')
+    out.append('#define KEYWORD_NONE    0xFFFF')
+    out.append('')
+    for group in ORDER:
+        table = GROUPS[group][2]
+        out.append('extern const uint8_t %s[%d];' % (table, table_size(groups[group])))
+    out.append('extern const uint16_t keyword_index[%d];' % (LAST_CHAR - FIRST_CHAR + 1))
+    out.append('extern const uint8_t keyword_trie[%d];' % trie_size(keywords))
+    out.append('')
+    out.append('#endif')
+    with open(path, 'w') as f:
+        f.write('\n'.join(out) + '\n')
+
+
+def table_size(keywords):
+    return sum(len(k[2]) for k in keywords) + 1
+
+
+def trie_size(keywords):
+    lines = []
+    return emit_edges(build_trie(keywords), '', lines)
+
+
+def flatten(keywords):
+    """
+    Return the trie as it is stored: the offset of the first edge for every
+    character and the edges, as (prefix, character, token, size below) tuples.
+    """
+    trie = build_trie(keywords)
+    lines = []
+    offsets = {}
+    for c in sorted(trie['edges']):
+        offsets[c] = 3 * len(lines)
+        single = {'edges': {c: trie['edges'][c]}}
+        emit_edges(single, '', lines)
+    return offsets, lines
+
+
+def write_source(path, base, keywords, groups):
+    out = []
+    out.append('/* Generated by tools/keywords.py from %s.def -- do not edit. */' % base)
+    out.append('')
+    out.append('#include "parser.h"')
+    out.append('')
+    out.append('/// @cond BASIC_KEYWORDS')
+    out.append('')
+    for group in ORDER:
+        comment, table = GROUPS[group][4], GROUPS[group][2]
+        if comment:
+            out.append('// ' + comment)
+        out.append('const uint8_t %s[%d] PROGMEM = {' % (table, table_size(groups[group])))
+        for keyword in groups[group]:
+            chars = [char_literal(c) for c in keyword[2]]
+            chars[-1] += ' + 0x80'
+            out.append('                %s,' % ', '.join(chars))
+        out.append('                0')
+        out.append('        };')
+
+    offsets, lines = flatten(keywords)
+    out.append('// first edge of the keyword trie for every character (see tokenize())')
+    out.append('const uint16_t keyword_index[%d] PROGMEM = {' % (LAST_CHAR - FIRST_CHAR + 1))
+    for code in range(FIRST_CHAR, LAST_CHAR + 1):
+        c = chr(code)
+        value = str(offsets[c]) if c in offsets else 'KEYWORD_NONE'
+        out.append('                %s,%s// %s' % (value, ' ' * (14 - len(value)), c))
+    out.append('        };')
+    out.append('// character, token of the keyword that ends there, size of the edges below')
+    out.append('const uint8_t keyword_trie[%d] PROGMEM = {' % (3 * len(lines)))
+    for prefix, char, token, below in lines:
+        out.append('                %s, %s, %d,%s// %s' % (char, token, below,
+                   ' ' * max(1, 32 - len(char) - len(token) - len(str(below))), prefix))
+    out.append('        };')
+    out.append('')
+    out.append('/// @endcond')
+    with open(path, 'w') as f:
+        f.write('\n'.join(out) + '\n')
+
+
+def trie_lookup(offsets, lines, text):
+    """Find the keyword text begins with, as tokenize() does; return (token, length)."""
+    if text[:1] not in offsets:
+        return None, 0
+    edge = offsets[text[0]] // 3
+    token, length = None, 0
+    position = 0
+    while True:
+        # the character of the edge matches -- keep the keyword that ends here (if any)
+        position += 1
+        if lines[edge][2] != '0':
+            token, length = lines[edge][2], position
+        # search the edges below for the next character (LF ends the line)
+        last = edge + 1 + lines[edge][3] // 3
+        edge += 1
+        c = text[position] if position < len(text) else '\n'
+        while edge < last and lines[edge][0][-1] != c:
+            edge += 1 + lines[edge][3] // 3
+        if edge == last:
+            return token, length
+
+
+def table_lookup(keywords, text):
+    """Find the keyword text begins with, searching the tables in order; return (token, length)."""
+    for keyword in keywords:
+        if text.startswith(keyword[2]):
+            return token_of(keyword), len(keyword[2])
+    return None, 0
+
+
+def check(keywords):
+    """Look texts up in the trie and in the keyword tables; return the number of mismatches."""
+    offsets, lines = flatten(keywords)
+    texts = set()
+    for keyword in keywords:
+        for end in range(1, len(keyword[2]) + 1):
+            texts.add(keyword[2][:end])
+        for code in range(FIRST_CHAR, LAST_CHAR + 1):
+            texts.add(keyword[2] + chr(code))
+    failed = 0
+    for text in sorted(texts):
+        found, expected = trie_lookup(offsets, lines, text), table_lookup(keywords, text)
+        if found != expected:
+            print('%s: the trie finds %s, the tables %s' % (text, found, expected), file=sys.stderr)
+            failed += 1
+    print('%d texts looked up, %d mismatches' % (len(texts), failed))
+    return failed
+
+
+def main():
+    args = sys.argv[1:]
+    checking = args[:1] == ['--check']
+    if checking:
+        args = args[1:]
+    if len(args) != 1:
+        sys.exit('usage: keywords.py [--check] keywords.def')
+    spec = args[0]
+    keywords = read_spec(spec)
+    if checking:
+        sys.exit(1 if check(keywords) else 0)
+    groups = {group: [k for k in keywords if k[0] == group] for group in ORDER}
+    root, _ = os.path.splitext(spec)
+    base = os.path.basename(root)
+    write_header(root + '.h', base, keywords, groups)
+    write_source(root + '.c', base, keywords, groups)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,244 @@
+#!/usr/bin/env python3
+#
+# XMODEM transfers to and from nstBASIC.
+#
+# Copyright 2016, Panagiotis Varelas <varelaspanos@gmail.com>
+#
+# nstBASIC is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# nstBASIC is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+
+"""
+Send programs to nstBASIC (XLOAD) and receive them from it (XSAVE, XSAVE LIST).
+
+usage: xmodem.py [-b BAUD] send PORT FILE
+       xmodem.py [-b BAUD] receive PORT FILE
+
+PORT is a serial port (or a pty). Type XLOAD (or XSAVE) on nstBASIC first,
+then run this tool. FILE is either a listing (text) or a program image saved
+by XSAVE; nstBASIC tells them apart by the first byte.
+
+The protocol is XMODEM with CRC-16: blocks of 128 bytes, numbered from 1,
+each followed by its CRC (high byte first). The receiver starts the transfer
+by sending 'C', then acknowledges every block with ACK or asks for it again
+with NAK. EOT ends the transfer and CAN cancels it. The last block is padded
+with SUB. XON and XOFF, which nstBASIC might send before the transfer
+begins, are ignored.
+"""
+
+import argparse
+import os
+import select
+import sys
+import termios
+import time
+
+SOH = 0x01
+EOT = 0x04
+ACK = 0x06
+NAK = 0x15
+CAN = 0x18
+SUB = 0x1A
+CRC = ord('C')
+
+BLOCK_SIZE = 128
+RETRIES = 10
+# seconds to wait: for the other side to start, between requests to start, for a reply, within a block
+START_TIMEOUT = 60
+START_INTERVAL = 3
+REPLY_TIMEOUT = 10
+TIMEOUT = 1
+
+# a program image begins with EEPROM_MAGIC ('n', 'B'), the version and its size
+IMAGE_MAGIC = b'nB'
+IMAGE_HEADER = 7
+
+
+class TransferError(Exception):
+    pass
+
+
+def crc16(data, crc=0):
+    """CRC-16 as _crc_xmodem_update() (polynomial 0x1021, initial value 0)."""
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+class Port:
+    """A serial port in raw mode."""
+
+    def __init__(self, path, baud):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        attrs = termios.tcgetattr(self.fd)
+        attrs[0] = 0                                    # no input processing (nor XON/XOFF)
+        attrs[1] = 0                                    # no output processing
+        attrs[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+        attrs[3] = 0                                    # no echo, no line editing
+        if baud is not None:
+            speed = getattr(termios, 'B%d' % baud, None)
+            if speed is None:
+                sys.exit('unsupported rate: %d' % baud)
+            attrs[4] = attrs[5] = speed
+        attrs[6][termios.VMIN] = 0
+        attrs[6][termios.VTIME] = 0
+        termios.tcsetattr(self.fd, termios.TCSANOW, attrs)
+        # whatever is left from an earlier transfer (the second CAN, for example)
+        termios.tcflush(self.fd, termios.TCIFLUSH)
+
+    def write(self, data):
+        while data:
+            data = data[os.write(self.fd, data):]
+
+    def read(self, timeout):
+        """Return one byte, or None if nothing arrives within timeout seconds."""
+        if not select.select([self.fd], [], [], timeout)[0]:
+            return None
+        data = os.read(self.fd, 1)
+        return data[0] if data else None
+
+    def purge(self):
+        """Drop whatever arrives, until the line is quiet."""
+        while self.read(TIMEOUT) is not None:
+            pass
+
+    def cancel(self):
+        self.write(bytes([CAN, CAN]))
+
+    def close(self):
+        os.close(self.fd)
+
+
+def wait_reply(port, expected, timeout):
+    """Return the first of the expected bytes (or None on timeout); XON/XOFF and noise are skipped."""
+    deadline = time.monotonic() + timeout
+    while True:
+        left = deadline - time.monotonic()
+        if left <= 0:
+            return None
+        byte = port.read(left)
+        if byte in expected:
+            return byte
+
+
+def send(port, data):
+    if wait_reply(port, (CRC, CAN), START_TIMEOUT) != CRC:
+        raise TransferError('the receiver did not start')
+    blocks = [data[i:i + BLOCK_SIZE] for i in range(0, len(data), BLOCK_SIZE)]
+    for number, block in enumerate(blocks, 1):
+        block = block.ljust(BLOCK_SIZE, bytes([SUB]))
+        crc = crc16(block)
+        frame = bytes([SOH, number & 0xFF, ~number & 0xFF]) + block + bytes([crc >> 8, crc & 0xFF])
+        for _ in range(RETRIES):
+            port.write(frame)
+            reply = wait_reply(port, (ACK, NAK, CAN), REPLY_TIMEOUT)
+            if reply == ACK:
+                break
+            if reply == CAN:
+                raise TransferError('cancelled by the receiver')
+        else:
+            port.cancel()
+            raise TransferError('block %d was not acknowledged' % number)
+        print('\rsent %d bytes' % min(number * BLOCK_SIZE, len(data)), end='', file=sys.stderr)
+    print(file=sys.stderr)
+    for _ in range(RETRIES):
+        port.write(bytes([EOT]))
+        reply = wait_reply(port, (ACK, NAK, CAN), REPLY_TIMEOUT)
+        if reply == ACK:
+            return
+        if reply == CAN:
+            raise TransferError('cancelled by the receiver')
+    raise TransferError('the end of the transfer was not acknowledged')
+
+
+def receive_block(port):
+    """Receive the rest of a block (after SOH); return (block number, data) or None if damaged."""
+    frame = bytearray()
+    while len(frame) < 2 + BLOCK_SIZE + 2:
+        byte = port.read(TIMEOUT)
+        if byte is None:
+            return None
+        frame.append(byte)
+    if frame[0] ^ frame[1] != 0xFF or crc16(frame[2:]) != 0:
+        return None
+    return frame[0], bytes(frame[2:2 + BLOCK_SIZE])
+
+
+def receive(port):
+    data = bytearray()
+    number = 1
+    reply = CRC
+    tries = 0
+    while True:
+        port.write(bytes([reply]))
+        byte = wait_reply(port, (SOH, EOT, CAN), START_INTERVAL if reply == CRC else REPLY_TIMEOUT)
+        if byte == EOT:
+            port.write(bytes([ACK]))
+            break
+        if byte == CAN:
+            raise TransferError('cancelled by the sender')
+        block = receive_block(port) if byte == SOH else None
+        if block is not None and block[0] == number & 0xFF:
+            data += block[1]
+            number += 1
+            reply = ACK
+            tries = 0
+            print('\rreceived %d bytes' % len(data), end='', file=sys.stderr)
+            continue
+        if block is not None and block[0] == (number - 1) & 0xFF:
+            reply = ACK
+            continue
+        if block is not None:
+            port.cancel()
+            raise TransferError('block %d is out of sequence' % block[0])
+        tries += 1
+        if tries == (START_TIMEOUT // START_INTERVAL if reply == CRC else RETRIES):
+            port.cancel()
+            raise TransferError('too many errors')
+        port.purge()
+        reply = CRC if number == 1 else NAK
+    print(file=sys.stderr)
+    # drop the padding (a program image knows its size)
+    if data.startswith(IMAGE_MAGIC) and len(data) >= IMAGE_HEADER:
+        size = data[3] | data[4] << 8
+        return bytes(data[:IMAGE_HEADER + size])
+    return bytes(data.rstrip(bytes([SUB])))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='XMODEM transfers to and from nstBASIC.')
+    parser.add_argument('-b', '--baud', type=int, help='serial rate (as selected by BAUD)')
+    parser.add_argument('direction', choices=('send', 'receive'))
+    parser.add_argument('port')
+    parser.add_argument('file')
+    args = parser.parse_args()
+
+    port = Port(args.port, args.baud)
+    try:
+        if args.direction == 'send':
+            with open(args.file, 'rb') as f:
+                send(port, f.read())
+        else:
+            data = receive(port)
+            with open(args.file, 'wb') as f:
+                f.write(data)
+    except TransferError as error:
+        sys.exit('xmodem: %s' % error)
+    finally:
+        port.close()
+
+
+if __name__ == '__main__':
+    main()